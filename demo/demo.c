@@ -28,6 +28,7 @@
 #include "hmac.h"
 #include "pbkdf2.h"
 #include "rng.h"
+#include "timer.h"
 
 const int states = 2;
 int state = 0;
@@ -250,6 +251,7 @@ int main(void)
 #endif
 
 	usbInit();
+	timer_init();
 
 	passlen = strlen((char *)pass);
 	saltlen = strlen((char *)salt);
@@ -266,6 +268,7 @@ int main(void)
 
 		do {
 			usbd_poll(usbd_dev);
+			oledAnimate();
 			switch (state) {
 				case 1:
 					layoutProgress("WORKING", frame % 41 * 25);
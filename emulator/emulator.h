@@ -31,9 +31,12 @@ extern void *emulator_flash_base;
 void emulatorPoll(void);
 void emulatorRandom(void *buffer, size_t size);
 
+#define EMULATOR_IFACE_MAIN 0
+#define EMULATOR_IFACE_U2F  1
+
 void emulatorSocketInit(void);
-size_t emulatorSocketRead(void *buffer, size_t size);
-size_t emulatorSocketWrite(const void *buffer, size_t size);
+size_t emulatorSocketRead(int *iface, void *buffer, size_t size);
+size_t emulatorSocketWrite(int iface, const void *buffer, size_t size);
 
 #endif
 
@@ -17,20 +17,281 @@
  * along with this library.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdlib.h>
+#include <string.h>
+
+#include "layout.h"
 #include "oled.h"
 
+/*
+ * Count what the hardware oledFlush() would push over SPI: a 6 byte
+ * window command plus the data of every dirty window. Set
+ * TREZOR_OLED_STATS to print the totals, and those of the progress
+ * screens (see layoutProgressStats), on exit.
+ */
+static uint32_t oled_refreshes = 0;
+static uint64_t oled_bytes = 0;
+
+static void oledPrintStats(void) {
+	fprintf(stderr, "oled: %u refreshes, %llu bytes, %.1f bytes per refresh\n",
+		oled_refreshes, (unsigned long long) oled_bytes,
+		oled_refreshes ? (double) oled_bytes / oled_refreshes : 0.0);
+
+	const LayoutProgressStats *progress = layoutProgressStats();
+	fprintf(stderr, "progress: %u updates, %u frames, %u ms sending frames\n",
+		progress->updates, progress->frames, progress->display_ms);
+}
+
+static void oledInitStats(void) {
+	if (getenv("TREZOR_OLED_STATS")) {
+		atexit(oledPrintStats);
+	}
+}
+
+static void oledCountWindow(const OledWindow *w) {
+	oled_bytes += 6 + (w->page_end - w->page_start + 1) * (w->col_end - w->col_start + 1);
+}
+
 #if HEADLESS
 
-void oledInit(void) {}
-void oledRefresh(void) {}
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+/*
+ * Set TREZOR_OLED_SHM to a POSIX shared memory name (e.g. /trezor-oled)
+ * to have every changed frame published there, so tests can look at the
+ * screen without a DebugLinkGetState round trip. frame is odd while the
+ * buffer is being written: readers copy the buffer once frame is even
+ * and retry if it changed meanwhile. On Linux, frame is also a futex
+ * woken on every update. The buffer is in the native oled.c layout, as
+ * in DebugLinkState.layout, but includes the debug link triangle, as the
+ * display shows it.
+ */
+#define OLED_SHM_MAGIC 0x44454c4f	/* "OLED" */
+
+typedef struct {
+	uint32_t magic;
+	uint32_t width;
+	uint32_t height;
+	volatile uint32_t frame;
+	uint8_t buffer[OLED_BUFSIZE];
+} OledShm;
+
+static OledShm *oled_shm = NULL;
+
+static void oledInitShm(void) {
+	const char *name = getenv("TREZOR_OLED_SHM");
+	if (!name) {
+		return;
+	}
+	int fd = shm_open(name, O_CREAT | O_RDWR, 0600);
+	if (fd < 0 || ftruncate(fd, sizeof(OledShm)) != 0) {
+		perror("Failed to open TREZOR_OLED_SHM");
+		exit(1);
+	}
+	oled_shm = mmap(NULL, sizeof(OledShm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (oled_shm == MAP_FAILED) {
+		perror("Failed to map TREZOR_OLED_SHM");
+		exit(1);
+	}
+	oled_shm->width = OLED_WIDTH;
+	oled_shm->height = OLED_HEIGHT;
+	oled_shm->frame = 0;
+	oled_shm->magic = OLED_SHM_MAGIC;
+}
+
+static void oledPublish(const uint8_t *buffer) {
+	oled_shm->frame++;
+	__sync_synchronize();
+	memcpy(oled_shm->buffer, buffer, OLED_BUFSIZE);
+	__sync_synchronize();
+	oled_shm->frame++;
+#ifdef __linux__
+	syscall(SYS_futex, &oled_shm->frame, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#endif
+}
+
+/*
+ * Set TREZOR_OLED_RECORD to an existing directory to save every frame that
+ * differs from the previous one as <sequence>-<hash>.pbm, white pixels
+ * lit. Identical screens hash the same, so repeated screens are easy to
+ * spot and compare between runs.
+ */
+static const char *oled_record = NULL;
+
+static void oledRecord(const uint8_t *buffer) {
+	static uint8_t last[OLED_BUFSIZE];
+	static uint32_t seq = 0;
+	if (seq > 0 && memcmp(last, buffer, OLED_BUFSIZE) == 0) {
+		return;
+	}
+	memcpy(last, buffer, OLED_BUFSIZE);
+
+	// FNV-1a, only used to name the file
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for (size_t i = 0; i < OLED_BUFSIZE; i++) {
+		hash = (hash ^ buffer[i]) * 0x100000001b3ULL;
+	}
+
+	// PBM rows are MSB leftmost and 1 is black
+	uint8_t rows[OLED_HEIGHT][OLED_WIDTH / 8];
+	memset(rows, 0xFF, sizeof(rows));
+	for (int y = 0; y < OLED_HEIGHT; y++) {
+		for (int x = 0; x < OLED_WIDTH; x++) {
+			if (buffer[OLED_BUFSIZE - 1 - x - (y / 8) * OLED_WIDTH] & (1 << (7 - y % 8))) {
+				rows[y][x / 8] &= ~(0x80 >> (x % 8));
+			}
+		}
+	}
+
+	char path[1024];
+	snprintf(path, sizeof(path), "%s/%06u-%016llx.pbm", oled_record, seq++, (unsigned long long) hash);
+	FILE *f = fopen(path, "wb");
+	if (!f) {
+		perror(path);
+		return;
+	}
+	fprintf(f, "P4\n%d %d\n", OLED_WIDTH, OLED_HEIGHT);
+	fwrite(rows, sizeof(rows), 1, f);
+	fclose(f);
+}
+
+void oledInit(void) {
+	oledInitStats();
+	oledInitShm();
+	oled_record = getenv("TREZOR_OLED_RECORD");
+}
+
+void oledFlush(void) {
+	oledInvertDebugLink();
+
+	int page = 0;
+	OledWindow w;
+	bool dirty = false;
+	while (oledDirtyWindow(&page, &w)) {
+		oledCountWindow(&w);
+		dirty = true;
+	}
+	oled_refreshes++;
+
+	oledMarkClean();
+
+	if (dirty && oled_shm) {
+		oledPublish(oledGetBuffer());
+	}
+	if (dirty && oled_record) {
+		oledRecord(oledGetBuffer());
+	}
+
+	oledInvertDebugLink();
+}
+
 void emulatorPoll(void) {}
 
 #else
 
 #include <SDL.h>
 
+/*
+ * SDL rendering stays on the main thread, which owns the window. The
+ * firmware only copies each refreshed buffer into the back frame; a
+ * conversion thread turns the latest one into ARGB pixels, and the main
+ * thread presents those from oledFlush() and emulatorPoll(), at most once
+ * per display refresh. Frames produced faster than that (swipes, progress
+ * bars) are coalesced and presentation never waits for the compositor.
+ */
 static SDL_Renderer *renderer = NULL;
 static SDL_Texture *texture = NULL;
+static SDL_Thread *convert_thread = NULL;
+static SDL_mutex *frame_lock = NULL;
+static SDL_cond *frame_cond = NULL;
+
+static uint8_t frames[2][OLED_BUFSIZE];
+static int frame_back = 0;	// written by the firmware
+static bool frame_pending = false;
+static bool convert_quit = false;
+
+static uint32_t pixels[2][OLED_HEIGHT][OLED_WIDTH];
+static int pixels_back = 0;	// written by the conversion thread
+static bool pixels_ready = false;
+
+static uint32_t present_interval = 0;
+static uint32_t present_last = 0;
+
+static void oledConvert(const uint8_t *buffer, uint32_t data[OLED_HEIGHT][OLED_WIDTH]) {
+	for (size_t i = 0; i < OLED_BUFSIZE; i++) {
+		int x = (OLED_BUFSIZE - 1 - i) % OLED_WIDTH;
+		int y = (OLED_BUFSIZE - 1 - i) / OLED_WIDTH * 8 + 7;
+
+		for (uint8_t shift = 0; shift < 8; shift++, y--) {
+			bool set = (buffer[i] >> shift) & 1;
+			data[y][x] = set ? 0xFFFFFFFF : 0xFF000000;
+		}
+	}
+}
+
+static int oledConvertFrames(void *arg) {
+	(void) arg;
+
+	SDL_LockMutex(frame_lock);
+	for (;;) {
+		while (!frame_pending && !convert_quit) {
+			SDL_CondWait(frame_cond, frame_lock);
+		}
+		if (convert_quit) {
+			break;
+		}
+		/* Swap: the firmware goes on with the other frame */
+		const uint8_t *front = frames[frame_back];
+		frame_back ^= 1;
+		frame_pending = false;
+		SDL_UnlockMutex(frame_lock);
+
+		oledConvert(front, pixels[pixels_back]);
+
+		SDL_LockMutex(frame_lock);
+		/* The main thread only reads pixels[pixels_back ^ 1] under the lock */
+		pixels_back ^= 1;
+		pixels_ready = true;
+	}
+	SDL_UnlockMutex(frame_lock);
+	return 0;
+}
+
+static void oledPresent(void) {
+	if (SDL_GetTicks() - present_last < present_interval) {
+		return;
+	}
+
+	SDL_LockMutex(frame_lock);
+	bool ready = pixels_ready;
+	if (ready) {
+		SDL_UpdateTexture(texture, NULL, pixels[pixels_back ^ 1], OLED_WIDTH * sizeof(uint32_t));
+		pixels_ready = false;
+	}
+	SDL_UnlockMutex(frame_lock);
+
+	if (ready) {
+		SDL_RenderCopy(renderer, texture, NULL, NULL);
+		SDL_RenderPresent(renderer);
+		present_last = SDL_GetTicks();
+	}
+}
+
+static void oledStopConvert(void) {
+	SDL_LockMutex(frame_lock);
+	convert_quit = true;
+	SDL_CondSignal(frame_cond);
+	SDL_UnlockMutex(frame_lock);
+	SDL_WaitThread(convert_thread, NULL);
+}
 
 void oledInit(void) {
 	if (SDL_Init(SDL_INIT_VIDEO) != 0) {
@@ -53,34 +314,57 @@ void oledInit(void) {
 
 	texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, OLED_WIDTH, OLED_HEIGHT);
 
+	/* Pace presentation to the display refresh rate */
+	int rate = 60;
+	SDL_DisplayMode mode;
+	if (SDL_GetCurrentDisplayMode(SDL_GetWindowDisplayIndex(window), &mode) == 0 && mode.refresh_rate > 0) {
+		rate = mode.refresh_rate;
+	}
+	present_interval = 1000 / rate;
+
+	frame_lock = SDL_CreateMutex();
+	frame_cond = SDL_CreateCond();
+	convert_thread = frame_lock && frame_cond ? SDL_CreateThread(oledConvertFrames, "oled", NULL) : NULL;
+	if (!convert_thread) {
+		fprintf(stderr, "Failed to start conversion thread: %s\n", SDL_GetError());
+		exit(1);
+	}
+	/* Runs before SDL_Quit */
+	atexit(oledStopConvert);
+
+	oledInitStats();
 	oledClear();
 	oledRefresh();
 }
 
-void oledRefresh(void) {
+void oledFlush(void) {
 	/* Draw triangle in upper right corner */
 	oledInvertDebugLink();
 
-	const uint8_t *buffer = oledGetBuffer();
+	/* Nothing to present unless the hardware would send something */
+	int page = 0;
+	OledWindow w;
+	bool dirty = false;
+	while (oledDirtyWindow(&page, &w)) {
+		oledCountWindow(&w);
+		dirty = true;
+	}
+	oled_refreshes++;
 
-	static uint32_t data[OLED_HEIGHT][OLED_WIDTH];
+	oledMarkClean();
 
-	for (size_t i = 0; i < OLED_BUFSIZE; i++) {
-		int x = (OLED_BUFSIZE - 1 - i) % OLED_WIDTH;
-		int y = (OLED_BUFSIZE - 1 - i) / OLED_WIDTH * 8 + 7;
-
-		for (uint8_t shift = 0; shift < 8; shift++, y--) {
-			bool set = (buffer[i] >> shift) & 1;
-			data[y][x] = set ? 0xFFFFFFFF : 0xFF000000;
-		}
+	if (dirty) {
+		SDL_LockMutex(frame_lock);
+		memcpy(frames[frame_back], oledGetBuffer(), OLED_BUFSIZE);
+		frame_pending = true;
+		SDL_CondSignal(frame_cond);
+		SDL_UnlockMutex(frame_lock);
 	}
 
-	SDL_UpdateTexture(texture, NULL, data, OLED_WIDTH * sizeof(uint32_t));
-	SDL_RenderCopy(renderer, texture, NULL, NULL);
-	SDL_RenderPresent(renderer);
-
 	/* Return it back */
 	oledInvertDebugLink();
+
+	oledPresent();
 }
 
 void emulatorPoll(void) {
@@ -91,6 +375,8 @@ void emulatorPoll(void) {
 			exit(1);
 		}
 	}
+
+	oledPresent();
 }
 
 #endif
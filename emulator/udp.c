@@ -25,34 +25,51 @@
 #include <sys/socket.h>
 
 #define TREZOR_UDP_PORT 21324
+#define TREZOR_U2F_UDP_PORT 21325
 
-static int fd = -1;
-static struct sockaddr_in from;
-static socklen_t fromlen;
+struct usb_socket {
+	int fd;
+	struct sockaddr_in from;
+	socklen_t fromlen;
+};
 
-void emulatorSocketInit(void) {
-	fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-	if (fd < 0) {
+static struct usb_socket sockets[2];
+
+static void socket_init(struct usb_socket *sock, int port) {
+	sock->fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (sock->fd < 0) {
 		perror("Failed to create socket");
 		exit(1);
 	}
 
-	fromlen = 0;
+	sock->fromlen = 0;
 
 	struct sockaddr_in addr;
 	addr.sin_family = AF_INET;
-	addr.sin_port = htons(TREZOR_UDP_PORT);
+	addr.sin_port = htons(port);
 	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
 
-	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+	if (bind(sock->fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
 		perror("Failed to bind socket");
 		exit(1);
 	}
 }
 
-size_t emulatorSocketRead(void *buffer, size_t size) {
-	fromlen = sizeof(from);
-	ssize_t n = recvfrom(fd, buffer, size, MSG_DONTWAIT, (struct sockaddr *) &from, &fromlen);
+static size_t socket_write(struct usb_socket *sock, const void *buffer, size_t size) {
+	if (sock->fromlen > 0) {
+		ssize_t n = sendto(sock->fd, buffer, size, MSG_DONTWAIT, (const struct sockaddr *) &sock->from, sock->fromlen);
+		if (n < 0 || ((size_t) n) != size) {
+			perror("Failed to write socket");
+			return 0;
+		}
+	}
+
+	return size;
+}
+
+static size_t socket_read(struct usb_socket *sock, void *buffer, size_t size) {
+	socklen_t fromlen = sizeof(sock->from);
+	ssize_t n = recvfrom(sock->fd, buffer, size, MSG_DONTWAIT, (struct sockaddr *) &sock->from, &fromlen);
 
 	if (n < 0) {
 		if (errno != EAGAIN && errno != EWOULDBLOCK) {
@@ -61,25 +78,36 @@ size_t emulatorSocketRead(void *buffer, size_t size) {
 		return 0;
 	}
 
+	sock->fromlen = fromlen;
+
 	static const char msg_ping[] = { 'P', 'I', 'N', 'G', 'P', 'I', 'N', 'G' };
 	static const char msg_pong[] = { 'P', 'O', 'N', 'G', 'P', 'O', 'N', 'G' };
 
 	if (n == sizeof(msg_ping) && memcmp(buffer, msg_ping, sizeof(msg_ping)) == 0) {
-		emulatorSocketWrite(msg_pong, sizeof(msg_pong));
+		socket_write(sock, msg_pong, sizeof(msg_pong));
 		return 0;
 	}
 
 	return n;
 }
 
-size_t emulatorSocketWrite(const void *buffer, size_t size) {
-	if (fromlen > 0) {
-		ssize_t n = sendto(fd, buffer, size, MSG_DONTWAIT, (const struct sockaddr *) &from, fromlen);
-		if (n < 0 || ((size_t) n) != size) {
-			perror("Failed to write socket");
-			return 0;
+void emulatorSocketInit(void) {
+	socket_init(&sockets[EMULATOR_IFACE_MAIN], TREZOR_UDP_PORT);
+	socket_init(&sockets[EMULATOR_IFACE_U2F], TREZOR_U2F_UDP_PORT);
+}
+
+size_t emulatorSocketRead(int *iface, void *buffer, size_t size) {
+	for (int i = 0; i < 2; i++) {
+		size_t n = socket_read(&sockets[i], buffer, size);
+		if (n > 0) {
+			*iface = i;
+			return n;
 		}
 	}
 
-	return size;
+	return 0;
+}
+
+size_t emulatorSocketWrite(int iface, const void *buffer, size_t size) {
+	return socket_write(&sockets[iface], buffer, size);
 }
@@ -6,8 +6,8 @@ coins_json = json.load(open('coins.json', 'r'))
 
 coins_stable, coins_debug = [], []
 
-if len(sys.argv) != 2 or sys.argv[1] not in ("count", "array"):
-    print("usage: coins-gen.py [count|array]\n", file=sys.stderr)
+if len(sys.argv) != 2 or sys.argv[1] not in ("count", "array", "index"):
+    print("usage: coins-gen.py [count|array|index]\n", file=sys.stderr)
     sys.exit(1)
 
 
@@ -44,6 +44,70 @@ def justify_width(coins):
                 coins[i][j] = (coins[i][j] + ',').ljust(l)
 
 
+def name_hash(name, seed):
+    # FNV-1a, must match coin_name_hash() in coins.c
+    h = (2166136261 ^ seed) & 0xffffffff
+    for c in bytearray(name.encode('utf-8')):
+        h = ((h ^ c) * 16777619) & 0xffffffff
+    return h
+
+
+def name_index(coins):
+    # Hash and displace: every bucket gets a seed that sends its names to
+    # free slots, so coinByName() needs two hashes and one strcmp.
+    names = [coin['coin_name'] for coin in coins]
+    nslots = max(len(names), 1)
+    nbuckets = max((len(names) + 1) // 2, 1)
+    buckets = [[] for _ in range(nbuckets)]
+    for i, name in enumerate(names):
+        buckets[name_hash(name, 0) % nbuckets].append(i)
+    seeds = [0] * nbuckets
+    slots = [None] * nslots
+    for b in sorted(range(nbuckets), key=lambda b: -len(buckets[b])):
+        if not buckets[b]:
+            continue
+        for seed in range(1, 0x10000):
+            taken = [name_hash(names[i], seed) % nslots for i in buckets[b]]
+            if len(set(taken)) == len(taken) and all(slots[t] is None for t in taken):
+                break
+        else:
+            print("coins-gen.py: no perfect hash for coin names\n", file=sys.stderr)
+            sys.exit(1)
+        seeds[b] = seed
+        for i, t in zip(buckets[b], taken):
+            slots[t] = i
+    return seeds, [0xffff if i is None else i for i in slots]
+
+
+def key_index(coins, key):
+    # (key, index) sorted by key; the first coin wins, as in a linear scan
+    index = {}
+    for i, coin in enumerate(coins):
+        index.setdefault(key(coin), i)
+    return sorted(index.items())
+
+
+def print_index(coins):
+    seeds, slots = name_index(coins)
+    print('#define COINS_NAME_BUCKETS %d' % len(seeds))
+    print('#define COINS_NAME_SLOTS %d' % len(slots))
+    print('static const uint16_t coins_name_seed[COINS_NAME_BUCKETS] = { %s };' % ', '.join('%d' % x for x in seeds))
+    print('static const uint16_t coins_name_slot[COINS_NAME_SLOTS] = { %s };' % ', '.join('%d' % x for x in slots))
+    for name, key in (
+        ('address_type', lambda coin: coin['address_type'] or 0),
+        ('coin_type', lambda coin: 0x80000000 + coin['bip44']),
+    ):
+        index = key_index(coins, key)
+        print('#define COINS_%s_INDEX_COUNT %d' % (name.upper(), len(index)))
+        print('static const CoinIndex coins_by_%s[COINS_%s_INDEX_COUNT] = {' % (name, name.upper()))
+        for k, i in index:
+            print('\t{ 0x%08x, %d },' % (k, i))
+        print('};')
+
+
+coins_stable_json = [coin for coin in coins_json if coin['firmware'] == 'stable']
+coins_debug_json = [coin for coin in coins_json if coin['firmware'] == 'debug']
+
 for coin in coins_json:
     if coin['firmware'] == 'stable':
         coins_stable.append(get_fields(coin))
@@ -67,6 +131,14 @@ if sys.argv[1] == "array":
     print('#endif')
 
 
+if sys.argv[1] == "index":
+    print('#if DEBUG_LINK')
+    print_index(coins_stable_json + coins_debug_json)
+    print('#else')
+    print_index(coins_stable_json)
+    print('#endif')
+
+
 if sys.argv[1] == "count":
     print('#if DEBUG_LINK')
     print('#define COINS_COUNT %d' % (len(coins_stable) + len(coins_debug)))
@@ -30,37 +30,64 @@ const CoinInfo coins[COINS_COUNT] = {
 #include "coins_array.h"
 };
 
-const CoinInfo *coinByName(const char *name)
+typedef struct {
+	uint32_t key;
+	uint16_t index;
+} CoinIndex;
+
+// side indices into coins[] generated by coins-gen.py
+#include "coins_index.h"
+
+static uint32_t coin_name_hash(const char *name, uint32_t seed)
 {
-	if (!name) return 0;
-	for (int i = 0; i < COINS_COUNT; i++) {
-		if (strcmp(name, coins[i].coin_name) == 0) {
-			return &(coins[i]);
-		}
+	// FNV-1a, must match name_hash() in coins-gen.py
+	uint32_t h = 2166136261u ^ seed;
+	while (*name) {
+		h ^= (uint8_t)*name++;
+		h *= 16777619u;
 	}
-	return 0;
+	return h;
 }
 
-const CoinInfo *coinByAddressType(uint32_t address_type)
+static const CoinInfo *coinByIndex(const CoinIndex *index, int count, uint32_t key)
 {
-	for (int i = 0; i < COINS_COUNT; i++) {
-		if (address_type == coins[i].address_type) {
-			return &(coins[i]);
+	int lo = 0, hi = count - 1;
+	while (lo <= hi) {
+		int mid = lo + (hi - lo) / 2;
+		if (index[mid].key == key) {
+			return &(coins[index[mid].index]);
+		}
+		if (index[mid].key < key) {
+			lo = mid + 1;
+		} else {
+			hi = mid - 1;
 		}
 	}
 	return 0;
 }
 
-const CoinInfo *coinByCoinType(uint32_t coin_type)
+const CoinInfo *coinByName(const char *name)
 {
-	for (int i = 0; i < COINS_COUNT; i++) {
-		if (coin_type == coins[i].coin_type) {
-			return &(coins[i]);
-		}
+	if (!name) return 0;
+	uint32_t bucket = coin_name_hash(name, 0) % COINS_NAME_BUCKETS;
+	uint32_t slot = coin_name_hash(name, coins_name_seed[bucket]) % COINS_NAME_SLOTS;
+	uint16_t i = coins_name_slot[slot];
+	if (i < COINS_COUNT && strcmp(name, coins[i].coin_name) == 0) {
+		return &(coins[i]);
 	}
 	return 0;
 }
 
+const CoinInfo *coinByAddressType(uint32_t address_type)
+{
+	return coinByIndex(coins_by_address_type, COINS_ADDRESS_TYPE_INDEX_COUNT, address_type);
+}
+
+const CoinInfo *coinByCoinType(uint32_t coin_type)
+{
+	return coinByIndex(coins_by_coin_type, COINS_COIN_TYPE_INDEX_COUNT, coin_type);
+}
+
 bool coinExtractAddressType(const CoinInfo *coin, const char *addr, uint32_t *address_type)
 {
 	if (!addr) return false;
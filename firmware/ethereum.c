@@ -37,6 +37,9 @@
 /* maximum supported chain id.  v must fit in an uint32_t. */
 #define MAX_CHAIN_ID 2147483630
 
+/* largest data chunk requested from the host; what fits in EthereumTxAck. */
+#define MAX_DATA_CHUNK sizeof(((EthereumTxAck *)NULL)->data_chunk.bytes)
+
 static bool ethereum_signing = false;
 static uint32_t data_total, data_left;
 static EthereumTxRequest msg_tx_request;
@@ -162,7 +165,7 @@ static void send_request_chunk(void)
 						   : data_left * 800 / data_total);
 	layoutProgress(_("Signing"), progress);
 	msg_tx_request.has_data_length = true;
-	msg_tx_request.data_length = data_left <= 1024 ? data_left : 1024;
+	msg_tx_request.data_length = data_left <= MAX_DATA_CHUNK ? data_left : MAX_DATA_CHUNK;
 	msg_write(MessageType_MessageType_EthereumTxRequest, &msg_tx_request);
 }
 
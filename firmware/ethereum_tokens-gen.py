@@ -0,0 +1,45 @@
+#!/usr/bin/env python2
+from __future__ import print_function
+import json, sys
+
+tokens_json = json.load(open('ethereum_tokens.json', 'r'))
+
+if len(sys.argv) != 2 or sys.argv[1] not in ("count", "array"):
+    print("usage: ethereum_tokens-gen.py [count|array]\n", file=sys.stderr)
+    sys.exit(1)
+
+
+def get_key(token):
+    return (token['chain_id'], bytearray.fromhex(token['address'][2:]))
+
+
+def get_fields(token):
+    return [
+        '%d' % token['chain_id'],
+        '"%s"' % ''.join('\\x%02x' % b for b in get_key(token)[1]),
+        '"%s"' % token['ticker'],
+        '%d' % token['decimals'],
+    ]
+
+
+# tokenByChainAddress() does a binary search, keep the table sorted
+tokens = sorted(tokens_json, key=get_key)
+
+for a, b in zip(tokens, tokens[1:]):
+    if get_key(a) == get_key(b):
+        print("duplicate token %s on chain %d\n" % (a['address'], a['chain_id']), file=sys.stderr)
+        sys.exit(1)
+
+for token in tokens:
+    if len(get_key(token)[1]) != 20:
+        print("bad address %s\n" % token['address'], file=sys.stderr)
+        sys.exit(1)
+
+print("// THIS IS A GENERATED FILE - DO NOT HAND EDIT\n\n")
+
+if sys.argv[1] == "array":
+    for token in tokens:
+        print('\t{' + ', '.join(get_fields(token)) + '},')
+
+if sys.argv[1] == "count":
+    print('#define TOKENS_COUNT %d' % len(tokens))
@@ -22,7 +22,7 @@
 
 #include <stdint.h>
 
-#define TOKENS_COUNT 125
+#include "ethereum_tokens_count.h"
 
 typedef struct {
     uint8_t chain_id;
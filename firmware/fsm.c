@@ -191,6 +191,34 @@ static const CoinInfo *fsm_getCoin(bool has_name, const char *name)
 	return coin;
 }
 
+// Recently derived nodes, so that consecutive requests on one account
+// (e.g. a hot wallet signing transaction after transaction) skip BIP-32
+// derivation. Entries are bound to the root node, so they go stale
+// together with the session seed.
+#define DERIVED_NODE_CACHE_SIZE 4
+
+typedef struct {
+	bool set;
+	uint32_t used;
+	uint8_t root[SHA256_DIGEST_LENGTH];
+	char curve[32];
+	uint32_t address_n[8];
+	size_t address_n_count;
+	HDNode node;
+} DerivedNodeCacheEntry;
+
+static CONFIDENTIAL DerivedNodeCacheEntry derivedNodeCache[DERIVED_NODE_CACHE_SIZE];
+static uint32_t derivedNodeCacheClock;
+
+static void fsm_rootDigest(const HDNode *node, uint8_t digest[SHA256_DIGEST_LENGTH])
+{
+	SHA256_CTX ctx;
+	sha256_Init(&ctx);
+	sha256_Update(&ctx, node->chain_code, sizeof(node->chain_code));
+	sha256_Update(&ctx, node->private_key, sizeof(node->private_key));
+	sha256_Final(&ctx, digest);
+}
+
 static HDNode *fsm_getDerivedNode(const char *curve, const uint32_t *address_n, size_t address_n_count)
 {
 	static CONFIDENTIAL HDNode node;
@@ -202,14 +230,153 @@ static HDNode *fsm_getDerivedNode(const char *curve, const uint32_t *address_n,
 	if (!address_n || address_n_count == 0) {
 		return &node;
 	}
+
+	uint8_t root[SHA256_DIGEST_LENGTH];
+	fsm_rootDigest(&node, root);
+
+	DerivedNodeCacheEntry *entry = &derivedNodeCache[0];
+	for (int i = 0; i < DERIVED_NODE_CACHE_SIZE; i++) {
+		DerivedNodeCacheEntry *e = &derivedNodeCache[i];
+		if (e->set && e->address_n_count == address_n_count
+			&& memcmp(e->address_n, address_n, address_n_count * sizeof(uint32_t)) == 0
+			&& strcmp(e->curve, curve) == 0
+			&& memcmp(e->root, root, sizeof(root)) == 0) {
+			e->used = ++derivedNodeCacheClock;
+			memcpy(&node, &e->node, sizeof(HDNode));
+			return &node;
+		}
+		// remember the least recently used entry
+		if (e->used < entry->used) {
+			entry = e;
+		}
+	}
+
 	if (hdnode_private_ckd_cached(&node, address_n, address_n_count, NULL) == 0) {
 		fsm_sendFailure(FailureType_Failure_ProcessError, _("Failed to derive private key"));
 		layoutHome();
 		return 0;
 	}
+
+	if (address_n_count <= sizeof(entry->address_n) / sizeof(uint32_t)
+		&& strlen(curve) < sizeof(entry->curve)) {
+		entry->set = true;
+		entry->used = ++derivedNodeCacheClock;
+		memcpy(entry->root, root, sizeof(root));
+		strlcpy(entry->curve, curve, sizeof(entry->curve));
+		memcpy(entry->address_n, address_n, address_n_count * sizeof(uint32_t));
+		entry->address_n_count = address_n_count;
+		memcpy(&entry->node, &node, sizeof(HDNode));
+	}
 	return &node;
 }
 
+// Recently used CipherKeyValue keys. A password manager unlocking many
+// entries under one path and key skips derivation and key expansion.
+#define CIPHER_KEY_CACHE_SIZE 4
+
+typedef struct {
+	bool set;
+	uint32_t used;
+	uint8_t id[SHA256_DIGEST_LENGTH];
+	uint8_t iv[16];
+	union {
+		aes_encrypt_ctx enc;
+		aes_decrypt_ctx dec;
+	} ctx;
+} CipherKeyCacheEntry;
+
+static CONFIDENTIAL CipherKeyCacheEntry cipherKeyCache[CIPHER_KEY_CACHE_SIZE];
+static uint32_t cipherKeyCacheClock;
+
+// Identities signed with during this session. Repeated SignIdentity
+// requests reuse the derived node together with its public key. Built
+// with IDENTITY_CONFIRM_ONCE=1, each identity is confirmed on the display
+// only the first time it is used while the device stays unlocked.
+#define IDENTITY_CACHE_SIZE 4
+
+typedef struct {
+	bool set;
+	uint32_t used;
+	uint8_t fingerprint[32];
+	char curve[32];
+	uint8_t root[SHA256_DIGEST_LENGTH];
+	HDNode node;
+} IdentityCacheEntry;
+
+static CONFIDENTIAL IdentityCacheEntry identityCache[IDENTITY_CACHE_SIZE];
+static uint32_t identityCacheClock;
+
+// root may be NULL to match an identity regardless of the session seed
+static IdentityCacheEntry *fsm_findIdentity(const uint8_t *fingerprint, const char *curve, const uint8_t *root)
+{
+	for (int i = 0; i < IDENTITY_CACHE_SIZE; i++) {
+		IdentityCacheEntry *e = &identityCache[i];
+		if (e->set && memcmp(e->fingerprint, fingerprint, sizeof(e->fingerprint)) == 0
+			&& strcmp(e->curve, curve) == 0
+			&& (!root || memcmp(e->root, root, sizeof(e->root)) == 0)) {
+			e->used = ++identityCacheClock;
+			return e;
+		}
+	}
+	return 0;
+}
+
+static void fsm_storeIdentity(const uint8_t *fingerprint, const char *curve, const uint8_t *root, const HDNode *node)
+{
+	if (strlen(curve) >= sizeof(identityCache[0].curve)) {
+		return;
+	}
+	// replace a stale entry for the same identity, else the least recently used one
+	IdentityCacheEntry *entry = fsm_findIdentity(fingerprint, curve, NULL);
+	if (!entry) {
+		entry = &identityCache[0];
+		for (int i = 1; i < IDENTITY_CACHE_SIZE; i++) {
+			if (identityCache[i].used < entry->used) {
+				entry = &identityCache[i];
+			}
+		}
+	}
+	entry->set = true;
+	entry->used = ++identityCacheClock;
+	memcpy(entry->fingerprint, fingerprint, sizeof(entry->fingerprint));
+	strlcpy(entry->curve, curve, sizeof(entry->curve));
+	memcpy(entry->root, root, sizeof(entry->root));
+	memcpy(&entry->node, node, sizeof(HDNode));
+}
+
+// Public key of the node last used for CoSi. A witness committing to
+// many statements under one path computes it only once. Like
+// cipherKeyCache, the entry is identified by a digest of the root node
+// and the path, so no copy of the private key is kept.
+static CONFIDENTIAL struct {
+	bool set;
+	uint8_t id[SHA256_DIGEST_LENGTH];
+	uint8_t public_key[32];
+} cosiKeyCache;
+
+// Digest of the message last confirmed for SignMessage. Built with
+// SIGN_MESSAGE_CONFIRM_ONCE=1, signing the same message with further
+// addresses (e.g. a proof-of-reserves challenge) is not confirmed again
+// while the device stays unlocked.
+static CONFIDENTIAL struct {
+	bool set;
+	uint8_t digest[SHA256_DIGEST_LENGTH];
+} signMessageCache;
+
+// called by session_clear() whenever the device is locked, wiped, loaded
+// or its session is reset
+void fsm_clearSessionCaches(void)
+{
+	memset(derivedNodeCache, 0, sizeof(derivedNodeCache));
+	derivedNodeCacheClock = 0;
+	memset(cipherKeyCache, 0, sizeof(cipherKeyCache));
+	cipherKeyCacheClock = 0;
+	memset(identityCache, 0, sizeof(identityCache));
+	identityCacheClock = 0;
+	memset(&cosiKeyCache, 0, sizeof(cosiKeyCache));
+	memset(&signMessageCache, 0, sizeof(signMessageCache));
+}
+
 void fsm_msgInitialize(Initialize *msg)
 {
 	(void)msg;
@@ -563,7 +730,7 @@ void fsm_msgCipherKeyValue(CipherKeyValue *msg)
 
 	CHECK_PIN
 
-	const HDNode *node = fsm_getDerivedNode(SECP256K1_NAME, msg->address_n, msg->address_n_count);
+	HDNode *node = fsm_getDerivedNode(SECP256K1_NAME, 0, 0);
 	if (!node) return;
 
 	bool encrypt = msg->has_encrypt && msg->encrypt;
@@ -583,17 +750,63 @@ void fsm_msgCipherKeyValue(CipherKeyValue *msg)
 	strlcat((char *)data, ask_on_encrypt ? "E1" : "E0", sizeof(data));
 	strlcat((char *)data, ask_on_decrypt ? "D1" : "D0", sizeof(data));
 
-	hmac_sha512(node->private_key, 32, data, strlen((char *)data), data);
+	// Cache entries are bound to the root node, so they go stale together
+	// with the session seed (passphrase change, wipe, load)
+	uint8_t id[SHA256_DIGEST_LENGTH];
+	SHA256_CTX sctx;
+	sha256_Init(&sctx);
+	sha256_Update(&sctx, node->chain_code, sizeof(node->chain_code));
+	sha256_Update(&sctx, node->private_key, sizeof(node->private_key));
+	sha256_Update(&sctx, (const uint8_t *)msg->address_n, msg->address_n_count * sizeof(uint32_t));
+	sha256_Update(&sctx, (const uint8_t *)&encrypt, sizeof(encrypt));
+	sha256_Update(&sctx, data, strlen((char *)data));
+	sha256_Final(&sctx, id);
+
+	CipherKeyCacheEntry *entry = NULL;
+	for (int i = 0; i < CIPHER_KEY_CACHE_SIZE; i++) {
+		if (cipherKeyCache[i].set && memcmp(cipherKeyCache[i].id, id, sizeof(id)) == 0) {
+			entry = &cipherKeyCache[i];
+			break;
+		}
+	}
+
+	if (!entry) {
+		if (msg->address_n_count > 0 && hdnode_private_ckd_cached(node, msg->address_n, msg->address_n_count, NULL) == 0) {
+			fsm_sendFailure(FailureType_Failure_ProcessError, _("Failed to derive private key"));
+			layoutHome();
+			return;
+		}
+
+		hmac_sha512(node->private_key, 32, data, strlen((char *)data), data);
+
+		// Evict the least recently used entry
+		entry = &cipherKeyCache[0];
+		for (int i = 1; i < CIPHER_KEY_CACHE_SIZE; i++) {
+			if (cipherKeyCache[i].used < entry->used) {
+				entry = &cipherKeyCache[i];
+			}
+		}
+		memcpy(entry->id, id, sizeof(id));
+		memcpy(entry->iv, data + 32, sizeof(entry->iv));
+		if (encrypt) {
+			aes_encrypt_key256(data, &entry->ctx.enc);
+		} else {
+			aes_decrypt_key256(data, &entry->ctx.dec);
+		}
+		entry->set = true;
+		memset(data, 0, sizeof(data));
+	}
+	entry->used = ++cipherKeyCacheClock;
+
+	// aes_cbc_* advance the iv in place
+	uint8_t iv[16];
+	memcpy(iv, (msg->iv.size == 16) ? msg->iv.bytes : entry->iv, sizeof(iv));
 
 	RESP_INIT(CipheredKeyValue);
 	if (encrypt) {
-		aes_encrypt_ctx ctx;
-		aes_encrypt_key256(data, &ctx);
-		aes_cbc_encrypt(msg->value.bytes, resp->value.bytes, msg->value.size, ((msg->iv.size == 16) ? (msg->iv.bytes) : (data + 32)), &ctx);
+		aes_cbc_encrypt(msg->value.bytes, resp->value.bytes, msg->value.size, iv, &entry->ctx.enc);
 	} else {
-		aes_decrypt_ctx ctx;
-		aes_decrypt_key256(data, &ctx);
-		aes_cbc_decrypt(msg->value.bytes, resp->value.bytes, msg->value.size, ((msg->iv.size == 16) ? (msg->iv.bytes) : (data + 32)), &ctx);
+		aes_cbc_decrypt(msg->value.bytes, resp->value.bytes, msg->value.size, iv, &entry->ctx.dec);
 	}
 	resp->has_value = true;
 	resp->value.size = msg->value.size;
@@ -847,14 +1060,51 @@ void fsm_msgEthereumGetAddress(EthereumGetAddress *msg)
 	layoutHome();
 }
 
+// Whether the confirm screen of a message leaves some of it unseen: past
+// what the screen shows, or in bytes it draws nothing for (a NUL ends the
+// line, other control bytes have no glyph).
+static bool fsm_messageHidden(const uint8_t *msg, uint32_t len)
+{
+	if (len > LAYOUT_MESSAGE_PAGE_LEN || layoutMessageShownLen(msg, len) < len) {
+		return true;
+	}
+	for (uint32_t i = 0; i < len; i++) {
+		if ((msg[i] < 0x20 && msg[i] != '\n') || msg[i] == 0x7f) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Show a message on one screen; messages it does not show in full
+// are additionally confirmed by the SHA-256 of their full contents.
+static bool fsm_confirmMessage(const uint8_t *msg, uint32_t len, bool sign)
+{
+	ButtonRequestType type = sign ? ButtonRequestType_ButtonRequest_ProtectCall : ButtonRequestType_ButtonRequest_Other;
+	if (sign) {
+		layoutSignMessage(msg, len);
+	} else {
+		layoutVerifyMessage(msg, len);
+	}
+	if (!protectButton(type, false)) {
+		return false;
+	}
+	if (fsm_messageHidden(msg, len)) {
+		layoutMessageDigest(msg, len);
+		if (!protectButton(type, false)) {
+			return false;
+		}
+	}
+	return true;
+}
+
 void fsm_msgEthereumSignMessage(EthereumSignMessage *msg)
 {
 	RESP_INIT(EthereumMessageSignature);
 
 	CHECK_INITIALIZED
 
-	layoutSignMessage(msg->message.bytes, msg->message.size);
-	if (!protectButton(ButtonRequestType_ButtonRequest_ProtectCall, false)) {
+	if (!fsm_confirmMessage(msg->message.bytes, msg->message.size, true)) {
 		fsm_sendFailure(FailureType_Failure_ActionCancelled, NULL);
 		layoutHome();
 		return;
@@ -887,8 +1137,7 @@ void fsm_msgEthereumVerifyMessage(EthereumVerifyMessage *msg)
 		layoutHome();
 		return;
 	}
-	layoutVerifyMessage(msg->message.bytes, msg->message.size);
-	if (!protectButton(ButtonRequestType_ButtonRequest_Other, false)) {
+	if (!fsm_confirmMessage(msg->message.bytes, msg->message.size, false)) {
 		fsm_sendFailure(FailureType_Failure_ActionCancelled, NULL);
 		layoutHome();
 		return;
@@ -913,11 +1162,25 @@ void fsm_msgSignMessage(SignMessage *msg)
 
 	CHECK_INITIALIZED
 
-	layoutSignMessage(msg->message.bytes, msg->message.size);
-	if (!protectButton(ButtonRequestType_ButtonRequest_ProtectCall, false)) {
-		fsm_sendFailure(FailureType_Failure_ActionCancelled, NULL);
-		layoutHome();
-		return;
+	bool confirmed = false;
+#if SIGN_MESSAGE_CONFIRM_ONCE
+	uint8_t digest[SHA256_DIGEST_LENGTH];
+	sha256_Raw(msg->message.bytes, msg->message.size, digest);
+	confirmed = signMessageCache.set
+		&& (!storage_hasPin() || session_isPinCached())
+		&& memcmp(signMessageCache.digest, digest, sizeof(digest)) == 0;
+#endif
+
+	if (!confirmed) {
+		if (!fsm_confirmMessage(msg->message.bytes, msg->message.size, true)) {
+			fsm_sendFailure(FailureType_Failure_ActionCancelled, NULL);
+			layoutHome();
+			return;
+		}
+#if SIGN_MESSAGE_CONFIRM_ONCE
+		signMessageCache.set = true;
+		memcpy(signMessageCache.digest, digest, sizeof(digest));
+#endif
 	}
 
 	CHECK_PIN
@@ -960,8 +1223,7 @@ void fsm_msgVerifyMessage(VerifyMessage *msg)
 			layoutHome();
 			return;
 		}
-		layoutVerifyMessage(msg->message.bytes, msg->message.size);
-		if (!protectButton(ButtonRequestType_ButtonRequest_Other, false)) {
+		if (!fsm_confirmMessage(msg->message.bytes, msg->message.size, false)) {
 			fsm_sendFailure(FailureType_Failure_ActionCancelled, NULL);
 			layoutHome();
 			return;
@@ -979,15 +1241,6 @@ void fsm_msgSignIdentity(SignIdentity *msg)
 
 	CHECK_INITIALIZED
 
-	layoutSignIdentity(&(msg->identity), msg->has_challenge_visual ? msg->challenge_visual : 0);
-	if (!protectButton(ButtonRequestType_ButtonRequest_ProtectCall, false)) {
-		fsm_sendFailure(FailureType_Failure_ActionCancelled, NULL);
-		layoutHome();
-		return;
-	}
-
-	CHECK_PIN
-
 	uint8_t hash[32];
 	if (!msg->has_identity || cryptoIdentityFingerprint(&(msg->identity), hash) == 0) {
 		fsm_sendFailure(FailureType_Failure_DataError, _("Invalid identity"));
@@ -995,19 +1248,64 @@ void fsm_msgSignIdentity(SignIdentity *msg)
 		return;
 	}
 
-	uint32_t address_n[5];
-	address_n[0] = 0x80000000 | 13;
-	address_n[1] = 0x80000000 | hash[ 0] | (hash[ 1] << 8) | (hash[ 2] << 16) | (hash[ 3] << 24);
-	address_n[2] = 0x80000000 | hash[ 4] | (hash[ 5] << 8) | (hash[ 6] << 16) | (hash[ 7] << 24);
-	address_n[3] = 0x80000000 | hash[ 8] | (hash[ 9] << 8) | (hash[10] << 16) | (hash[11] << 24);
-	address_n[4] = 0x80000000 | hash[12] | (hash[13] << 8) | (hash[14] << 16) | (hash[15] << 24);
-
 	const char *curve = SECP256K1_NAME;
 	if (msg->has_ecdsa_curve_name) {
 		curve = msg->ecdsa_curve_name;
 	}
-	HDNode *node = fsm_getDerivedNode(curve, address_n, 5);
-	if (!node) return;
+
+	bool confirmed = false;
+#if IDENTITY_CONFIRM_ONCE
+	if (!storage_hasPin() || session_isPinCached()) {
+		// identities are only cached after they were confirmed
+		confirmed = fsm_findIdentity(hash, curve, NULL) != 0;
+	}
+#endif
+
+	if (!confirmed) {
+		layoutSignIdentity(&(msg->identity), msg->has_challenge_visual ? msg->challenge_visual : 0);
+		if (!protectButton(ButtonRequestType_ButtonRequest_ProtectCall, false)) {
+			fsm_sendFailure(FailureType_Failure_ActionCancelled, NULL);
+			layoutHome();
+			return;
+		}
+	}
+
+	CHECK_PIN
+
+	const HDNode *root_node = fsm_getDerivedNode(curve, 0, 0);
+	if (!root_node) return;
+	uint8_t root[SHA256_DIGEST_LENGTH];
+	fsm_rootDigest(root_node, root);
+
+	static CONFIDENTIAL HDNode identity_node;
+	HDNode *node = &identity_node;
+	const IdentityCacheEntry *entry = fsm_findIdentity(hash, curve, root);
+	if (entry) {
+		memcpy(node, &entry->node, sizeof(HDNode));
+	} else {
+		if (confirmed) {
+			// the session seed changed since this identity was confirmed
+			layoutSignIdentity(&(msg->identity), msg->has_challenge_visual ? msg->challenge_visual : 0);
+			if (!protectButton(ButtonRequestType_ButtonRequest_ProtectCall, false)) {
+				fsm_sendFailure(FailureType_Failure_ActionCancelled, NULL);
+				layoutHome();
+				return;
+			}
+		}
+
+		uint32_t address_n[5];
+		address_n[0] = 0x80000000 | 13;
+		address_n[1] = 0x80000000 | hash[ 0] | (hash[ 1] << 8) | (hash[ 2] << 16) | (hash[ 3] << 24);
+		address_n[2] = 0x80000000 | hash[ 4] | (hash[ 5] << 8) | (hash[ 6] << 16) | (hash[ 7] << 24);
+		address_n[3] = 0x80000000 | hash[ 8] | (hash[ 9] << 8) | (hash[10] << 16) | (hash[11] << 24);
+		address_n[4] = 0x80000000 | hash[12] | (hash[13] << 8) | (hash[14] << 16) | (hash[15] << 24);
+
+		const HDNode *derived = fsm_getDerivedNode(curve, address_n, 5);
+		if (!derived) return;
+		memcpy(node, derived, sizeof(HDNode));
+		hdnode_fill_public_key(node);
+		fsm_storeIdentity(hash, curve, root, node);
+	}
 
 	bool sign_ssh = msg->identity.has_proto && (strcmp(msg->identity.proto, "ssh") == 0);
 	bool sign_gpg = msg->identity.has_proto && (strcmp(msg->identity.proto, "gpg") == 0);
@@ -1026,7 +1324,6 @@ void fsm_msgSignIdentity(SignIdentity *msg)
 	}
 
 	if (result == 0) {
-		hdnode_fill_public_key(node);
 		if (strcmp(curve, SECP256K1_NAME) != 0) {
 			resp->has_address = false;
 		} else {
@@ -1377,10 +1674,13 @@ void fsm_msgNEMSignTx(NEMSignTx *msg) {
 	nem_transaction_start(&context, &node->public_key[1], resp->data.bytes, sizeof(resp->data.bytes));
 
 	if (msg->has_multisig) {
-		uint8_t buffer[sizeof(resp->data.bytes)];
+		// inner transaction is as large as the signed one, stage it in
+		// the unused rest of msg_resp after the response
+		uint8_t *buffer = msg_resp + sizeof(NEMSignedTx);
+		_Static_assert(sizeof(msg_resp) >= sizeof(NEMSignedTx) + sizeof(resp->data.bytes), "msg_resp too small for the inner NEM transaction");
 
 		nem_transaction_ctx inner;
-		nem_transaction_start(&inner, msg->multisig.signer.bytes, buffer, sizeof(buffer));
+		nem_transaction_start(&inner, msg->multisig.signer.bytes, buffer, sizeof(resp->data.bytes));
 
 		if (msg->has_transfer && !nem_fsmTransfer(&inner, NULL, &msg->multisig, &msg->transfer)) {
 			layoutHome();
@@ -1524,6 +1824,40 @@ void fsm_msgNEMDecryptMessage(NEMDecryptMessage *msg)
 	layoutHome();
 }
 
+static void fsm_cosiNonce(const HDNode *node, const uint8_t *data, uint32_t len, uint8_t nonce[32])
+{
+	sha256_Raw(data, len, nonce);
+	rfc6979_state rng;
+	init_rfc6979(node->private_key, nonce, &rng);
+	generate_rfc6979(nonce, &rng);
+	memset(&rng, 0, sizeof(rng));
+}
+
+static bool fsm_cosiKeyId(const uint32_t *address_n, size_t address_n_count, uint8_t id[SHA256_DIGEST_LENGTH])
+{
+	const HDNode *root_node = fsm_getDerivedNode(ED25519_NAME, 0, 0);
+	if (!root_node) return false;
+	uint8_t root[SHA256_DIGEST_LENGTH];
+	fsm_rootDigest(root_node, root);
+
+	SHA256_CTX ctx;
+	sha256_Init(&ctx);
+	sha256_Update(&ctx, root, sizeof(root));
+	sha256_Update(&ctx, (const uint8_t *)address_n, address_n_count * sizeof(uint32_t));
+	sha256_Final(&ctx, id);
+	return true;
+}
+
+static void fsm_cosiPublicKey(const HDNode *node, const uint8_t id[SHA256_DIGEST_LENGTH], uint8_t public_key[32])
+{
+	if (!cosiKeyCache.set || memcmp(cosiKeyCache.id, id, sizeof(cosiKeyCache.id)) != 0) {
+		ed25519_publickey(node->private_key, cosiKeyCache.public_key);
+		memcpy(cosiKeyCache.id, id, sizeof(cosiKeyCache.id));
+		cosiKeyCache.set = true;
+	}
+	memcpy(public_key, cosiKeyCache.public_key, 32);
+}
+
 void fsm_msgCosiCommit(CosiCommit *msg)
 {
 	RESP_INIT(CosiCommitment);
@@ -1541,14 +1875,14 @@ void fsm_msgCosiCommit(CosiCommit *msg)
 
 	CHECK_PIN
 
+	uint8_t id[SHA256_DIGEST_LENGTH];
+	if (!fsm_cosiKeyId(msg->address_n, msg->address_n_count, id)) return;
+
 	HDNode *node = fsm_getDerivedNode(ED25519_NAME, msg->address_n, msg->address_n_count);
 	if (!node) return;
 
 	uint8_t nonce[32];
-	sha256_Raw(msg->data.bytes, msg->data.size, nonce);
-	rfc6979_state rng;
-	init_rfc6979(node->private_key, nonce, &rng);
-	generate_rfc6979(nonce, &rng);
+	fsm_cosiNonce(node, msg->data.bytes, msg->data.size, nonce);
 
 	resp->has_commitment = true;
 	resp->has_pubkey = true;
@@ -1556,7 +1890,7 @@ void fsm_msgCosiCommit(CosiCommit *msg)
 	resp->pubkey.size = 32;
 
 	ed25519_publickey(nonce, resp->commitment.bytes);
-	ed25519_publickey(node->private_key, resp->pubkey.bytes);
+	fsm_cosiPublicKey(node, id, resp->pubkey.bytes);
 
 	msg_write(MessageType_MessageType_CosiCommitment, resp);
 	layoutHome();
@@ -1585,10 +1919,7 @@ void fsm_msgCosiSign(CosiSign *msg)
 	if (!node) return;
 
 	uint8_t nonce[32];
-	sha256_Raw(msg->data.bytes, msg->data.size, nonce);
-	rfc6979_state rng;
-	init_rfc6979(node->private_key, nonce, &rng);
-	generate_rfc6979(nonce, &rng);
+	fsm_cosiNonce(node, msg->data.bytes, msg->data.size, nonce);
 
 	resp->has_signature = true;
 	resp->signature.size = 32;
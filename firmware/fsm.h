@@ -34,6 +34,8 @@ void fsm_sendFailureDebug(FailureType code, const char *text, const char *source
 void fsm_sendFailure(FailureType code, const char *text);
 #endif
 
+void fsm_clearSessionCaches(void);
+
 void fsm_msgInitialize(Initialize *msg);
 void fsm_msgGetFeatures(GetFeatures *msg);
 void fsm_msgPing(Ping *msg);
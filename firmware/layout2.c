@@ -30,6 +30,7 @@
 #include "qr_encode.h"
 #include "timer.h"
 #include "bignum.h"
+#include "sha2.h"
 #include "secp256k1.h"
 #include "nem2.h"
 #include "gettext.h"
@@ -63,6 +64,93 @@ static const char **split_message(const uint8_t *msg, uint32_t len, uint32_t row
 	return ret;
 }
 
+// Message text wrapped by pixel width into the dialog lines right of the
+// 16 px icon, with per byte advances taken from the font once. Only the
+// lines shown on screen are broken; the last one leaves room for "..."
+// so no text hides behind it.
+#define TEXT_WIDTH      (OLED_WIDTH - 16 - 4)
+#define TEXT_LINES      4
+#define TEXT_LINE_BYTES 64
+
+static uint8_t textAdvance[256];
+
+static struct {
+	const uint8_t *msg;
+	uint32_t len;
+	uint32_t lines;                  // line breaks found so far
+	uint16_t start[TEXT_LINES + 1];  // start[lines] is where to go on
+} textLayout;
+
+static void textReset(const uint8_t *msg, uint32_t len)
+{
+	if (!textAdvance[' ']) {
+		for (int c = 0; c < 256; c++) {
+			char g = oledConvertChar(c);
+			textAdvance[c] = g ? fontCharWidth(g) + 1 : 0;
+		}
+	}
+	textLayout.msg = msg;
+	textLayout.len = len < UINT16_MAX ? len : UINT16_MAX;
+	textLayout.lines = 0;
+	textLayout.start[0] = 0;
+}
+
+// find the breaks of the lines on screen
+static void textBreak(void)
+{
+	while (textLayout.lines < TEXT_LINES && textLayout.start[textLayout.lines] < textLayout.len) {
+		int room = TEXT_WIDTH;
+		if (textLayout.lines == TEXT_LINES - 1) {
+			room -= 3 * textAdvance['.'];
+		}
+		uint32_t pos = textLayout.start[textLayout.lines], end = pos;
+		int width = 0;
+		while (end < textLayout.len && textLayout.msg[end] != '\n' && end - pos < TEXT_LINE_BYTES) {
+			// the spacing after the last glyph may stick out
+			if (width + textAdvance[textLayout.msg[end]] - 1 > room) {
+				break;
+			}
+			width += textAdvance[textLayout.msg[end]];
+			end++;
+		}
+		if (end < textLayout.len && (textLayout.msg[end] == '\n' || end == pos)) {
+			end++;
+		}
+		textLayout.start[++textLayout.lines] = end;
+	}
+}
+
+static const char **textPage(void)
+{
+	static char str[TEXT_LINES][TEXT_LINE_BYTES + 3 + 1];
+	static const char *ret[TEXT_LINES] = { str[0], str[1], str[2], str[3] };
+	textBreak();
+	for (uint32_t i = 0; i < TEXT_LINES; i++) {
+		uint32_t n = 0;
+		if (i < textLayout.lines) {
+			uint32_t pos = textLayout.start[i];
+			n = textLayout.start[i + 1] - pos;
+			if (n > 0 && textLayout.msg[pos + n - 1] == '\n') {
+				n--;
+			}
+			memcpy(str[i], textLayout.msg + pos, n);
+		}
+		str[i][n] = 0;
+	}
+	if (textLayout.lines == TEXT_LINES && textLayout.start[TEXT_LINES] < textLayout.len) {
+		strlcat(str[TEXT_LINES - 1], "...", sizeof(str[0]));
+	}
+	return ret;
+}
+
+// bytes of a message shown by layoutSignMessage and the like
+uint32_t layoutMessageShownLen(const uint8_t *msg, uint32_t len)
+{
+	textReset(msg, len);
+	textBreak();
+	return textLayout.start[textLayout.lines];
+}
+
 void *layoutLast = layoutHome;
 
 void layoutDialogSwipe(const BITMAP *icon, const char *btnNo, const char *btnYes, const char *desc, const char *line1, const char *line2, const char *line3, const char *line4, const char *line5, const char *line6)
@@ -83,6 +171,16 @@ void layoutProgressSwipe(const char *desc, int permil)
 	layoutProgress(desc, permil);
 }
 
+// composed home screen, dropped whenever storage is committed or the
+// pending backup flag changes (see storage_clear_update)
+static uint8_t homeFrame[OLED_BUFSIZE];
+static bool homeFrameValid = false;
+
+void layoutHomeInvalidate(void)
+{
+	homeFrameValid = false;
+}
+
 void layoutScreensaver(void)
 {
 	layoutLast = layoutScreensaver;
@@ -98,25 +196,32 @@ void layoutHome(void)
 		layoutSwipe();
 	}
 	layoutLast = layoutHome;
-	const char *label = storage_isInitialized() ? storage_getLabel() : _("Go to trezor.io/start");
-	const uint8_t *homescreen = storage_getHomescreen();
-	if (homescreen) {
-		BITMAP b;
-		b.width = 128;
-		b.height = 64;
-		b.data = homescreen;
-		oledDrawBitmap(0, 0, &b);
+	if (homeFrameValid) {
+		oledSetBuffer(homeFrame);
 	} else {
-		if (label && strlen(label) > 0) {
-			oledDrawBitmap(44, 4, &bmp_logo48);
-			oledDrawStringCenter(OLED_HEIGHT - 8, label);
+		const char *label = storage_isInitialized() ? storage_getLabel() : _("Go to trezor.io/start");
+		const uint8_t *homescreen = storage_getHomescreen();
+		if (homescreen) {
+			BITMAP b;
+			b.width = 128;
+			b.height = 64;
+			b.data = homescreen;
+			b.packed = 0;
+			oledDrawBitmap(0, 0, &b);
 		} else {
-			oledDrawBitmap(40, 0, &bmp_logo64);
+			if (label && strlen(label) > 0) {
+				oledDrawBitmap(44, 4, &bmp_logo48);
+				oledDrawStringCenter(OLED_HEIGHT - 8, label);
+			} else {
+				oledDrawBitmap(40, 0, &bmp_logo64);
+			}
 		}
-	}
-	if (storage_needsBackup()) {
-		oledBox(0, 0, 127, 8, false);
-		oledDrawStringCenter(0, "NEEDS BACKUP!");
+		if (storage_needsBackup()) {
+			oledBox(0, 0, 127, 8, false);
+			oledDrawStringCenter(0, "NEEDS BACKUP!");
+		}
+		memcpy(homeFrame, oledGetBuffer(), OLED_BUFSIZE);
+		homeFrameValid = true;
 	}
 	oledRefresh();
 
@@ -223,12 +328,26 @@ void layoutFeeOverThreshold(const CoinInfo *coin, uint64_t fee)
 
 void layoutSignMessage(const uint8_t *msg, uint32_t len)
 {
-	const char **str = split_message(msg, len, 16);
+	textReset(msg, len);
+	const char **str = textPage();
 	layoutDialogSwipe(&bmp_icon_question, _("Cancel"), _("Confirm"),
 		_("Sign message?"),
 		str[0], str[1], str[2], str[3], NULL, NULL);
 }
 
+void layoutMessageDigest(const uint8_t *msg, uint32_t len)
+{
+	uint8_t digest[SHA256_DIGEST_LENGTH];
+	char hex[SHA256_DIGEST_LENGTH * 2 + 1];
+	sha256_Raw(msg, len, digest);
+	data2hex(digest, sizeof(digest), hex);
+	const char **str = split_message((const uint8_t *)hex, strlen(hex), 16);
+	layoutDialogSwipe(&bmp_icon_question, _("Cancel"), _("Confirm"),
+		_("Message SHA-256:"),
+		str[0], str[1], str[2], str[3], NULL, NULL);
+	memset(digest, 0, sizeof(digest));
+}
+
 void layoutVerifyAddress(const char *address)
 {
 	const char **str = split_message((const uint8_t *)address, strlen(address), 17);
@@ -240,7 +359,8 @@ void layoutVerifyAddress(const char *address)
 
 void layoutVerifyMessage(const uint8_t *msg, uint32_t len)
 {
-	const char **str = split_message(msg, len, 16);
+	textReset(msg, len);
+	const char **str = textPage();
 	layoutDialogSwipe(&bmp_icon_info, _("Cancel"), _("Confirm"),
 		_("Verified message"),
 		str[0], str[1], str[2], str[3], NULL, NULL);
@@ -256,7 +376,8 @@ void layoutCipherKeyValue(bool encrypt, const char *key)
 
 void layoutEncryptMessage(const uint8_t *msg, uint32_t len, bool signing)
 {
-	const char **str = split_message(msg, len, 16);
+	textReset(msg, len);
+	const char **str = textPage();
 	layoutDialogSwipe(&bmp_icon_question, _("Cancel"), _("Confirm"),
 		signing ? _("Encrypt+Sign message?") : _("Encrypt message?"),
 		str[0], str[1], str[2], str[3], NULL, NULL);
@@ -264,7 +385,8 @@ void layoutEncryptMessage(const uint8_t *msg, uint32_t len, bool signing)
 
 void layoutDecryptMessage(const uint8_t *msg, uint32_t len, const char *address)
 {
-	const char **str = split_message(msg, len, 16);
+	textReset(msg, len);
+	const char **str = textPage();
 	layoutDialogSwipe(&bmp_icon_info, NULL, _("OK"),
 		address ? _("Decrypted signed message") : _("Decrypted message"),
 		str[0], str[1], str[2], str[3], NULL, NULL);
@@ -441,6 +563,47 @@ static const char *address_n_str(const uint32_t *address_n, size_t address_n_cou
 	return c;
 }
 
+// Recently encoded QR codes, so that switching an address between its
+// text and QR view does not run qr_encode again
+#define QR_CACHE_SIZE 4
+
+typedef struct {
+	bool set;
+	uint32_t used;
+	int level;
+	int side;
+	char text[76];	// Address.address max_size
+	unsigned char bitdata[QR_MAX_BITDATA];
+} QRCacheEntry;
+
+static QRCacheEntry qrCache[QR_CACHE_SIZE];
+static uint32_t qrCacheClock;
+
+static const QRCacheEntry *layoutQREncode(int level, const char *text)
+{
+	// the cached code, else encode into the least recently used entry
+	QRCacheEntry *entry = &qrCache[0];
+	for (int i = 0; i < QR_CACHE_SIZE; i++) {
+		QRCacheEntry *e = &qrCache[i];
+		if (e->set && e->level == level && strcmp(e->text, text) == 0) {
+			e->used = ++qrCacheClock;
+			return e;
+		}
+		if (e->used < entry->used) {
+			entry = e;
+		}
+	}
+	entry->used = ++qrCacheClock;
+	entry->level = level;
+	entry->side = qr_encode(level, 0, text, 0, entry->bitdata);
+	// texts too long to remember are encoded every time
+	entry->set = strlen(text) < sizeof(entry->text);
+	if (entry->set) {
+		strlcpy(entry->text, text, sizeof(entry->text));
+	}
+	return entry;
+}
+
 void layoutAddress(const char *address, const char *desc, bool qrcode, bool ignorecase, const uint32_t *address_n, size_t address_n_count)
 {
 	if (layoutLast != layoutAddress) {
@@ -452,7 +615,6 @@ void layoutAddress(const char *address, const char *desc, bool qrcode, bool igno
 
 	uint32_t addrlen = strlen(address);
 	if (qrcode) {
-		static unsigned char bitdata[QR_MAX_BITDATA];
 		char address_upcase[addrlen + 1];
 		if (ignorecase) {
 			for (uint32_t i = 0; i < addrlen + 1; i++) {
@@ -460,31 +622,17 @@ void layoutAddress(const char *address, const char *desc, bool qrcode, bool igno
 					address[i] + 'A' - 'a' : address[i];
 			}
 		}
-		int side = qr_encode(addrlen <= (ignorecase ? 60 : 40) ? QR_LEVEL_M : QR_LEVEL_L, 0,
-							 ignorecase ? address_upcase : address, 0, bitdata);
+		const QRCacheEntry *qr = layoutQREncode(addrlen <= (ignorecase ? 60 : 40) ? QR_LEVEL_M : QR_LEVEL_L,
+							 ignorecase ? address_upcase : address);
+		int side = qr->side;
 
 		oledInvert(0, 0, 63, 63);
 		if (side > 0 && side <= 29) {
 			int offset = 32 - side;
-			for (int i = 0; i < side; i++) {
-				for (int j = 0; j< side; j++) {
-					int a = j * side + i;
-					if (bitdata[a / 8] & (1 << (7 - a % 8))) {
-						oledBox(offset + i * 2, offset + j * 2,
-								offset + 1 + i * 2, offset + 1 + j * 2, false);
-					}
-				}
-			}
+			oledDrawBits(offset, offset, qr->bitdata, side, side, 2, true);
 		} else if (side > 0 && side <= 60) {
-			int offset = 32 - (side / 2); 
-			for (int i = 0; i < side; i++) {
-				for (int j = 0; j< side; j++) {
-					int a = j * side + i;
-					if (bitdata[a / 8] & (1 << (7 - a % 8))) {
-						oledClearPixel(offset + i, offset + j);
-					}
-				}
-			}
+			int offset = 32 - (side / 2);
+			oledDrawBits(offset, offset, qr->bitdata, side, side, 1, true);
 		}
 	} else {
 		uint32_t rowlen = (addrlen - 1) / (addrlen <= 40 ? 2 : addrlen <= 60 ? 3 : 4) + 1;
@@ -752,7 +900,8 @@ void layoutNEMTransferPayload(const uint8_t *payload, size_t length, bool encryp
 			encrypted ? _("Encrypted hex data") : _("Unencrypted hex data"),
 			str[0], str[1], str[2], str[3], NULL, NULL);
 	} else {
-		const char **str = split_message(payload, length, 16);
+		textReset(payload, length);
+		const char **str = textPage();
 		layoutDialogSwipe(&bmp_icon_question, _("Cancel"), _("Next"),
 			encrypted ? _("Encrypted message") : _("Unencrypted message"),
 			str[0], str[1], str[2], str[3], NULL, NULL);
@@ -760,7 +909,8 @@ void layoutNEMTransferPayload(const uint8_t *payload, size_t length, bool encryp
 }
 
 void layoutNEMMosaicDescription(const char *description) {
-	const char **str = split_message((uint8_t *) description, strlen(description), 16);
+	textReset((const uint8_t *)description, strlen(description));
+	const char **str = textPage();
 	layoutDialogSwipe(&bmp_icon_question, _("Cancel"), _("Next"),
 		_("Mosaic Description"),
 		str[0], str[1], str[2], str[3], NULL, NULL);
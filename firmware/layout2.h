@@ -29,6 +29,9 @@
 
 extern void *layoutLast;
 
+// characters of a message shown on its first (and only) confirm page
+#define LAYOUT_MESSAGE_PAGE_LEN (4 * 16)
+
 #if DEBUG_LINK
 #define layoutSwipe oledClear
 #else
@@ -40,11 +43,14 @@ void layoutProgressSwipe(const char *desc, int permil);
 
 void layoutScreensaver(void);
 void layoutHome(void);
+void layoutHomeInvalidate(void);
 void layoutConfirmOutput(const CoinInfo *coin, const TxOutputType *out);
 void layoutConfirmOpReturn(const uint8_t *data, uint32_t size);
 void layoutConfirmTx(const CoinInfo *coin, uint64_t amount_out, uint64_t amount_fee);
 void layoutFeeOverThreshold(const CoinInfo *coin, uint64_t fee);
 void layoutSignMessage(const uint8_t *msg, uint32_t len);
+uint32_t layoutMessageShownLen(const uint8_t *msg, uint32_t len);
+void layoutMessageDigest(const uint8_t *msg, uint32_t len);
 void layoutVerifyAddress(const char *address);
 void layoutVerifyMessage(const uint8_t *msg, uint32_t len);
 void layoutCipherKeyValue(bool encrypt, const char *key);
@@ -26,6 +26,7 @@
 #include "protect.h"
 #include "rng.h"
 #include "secp256k1.h"
+#include "util.h"
 
 const char *nem_validate_common(NEMTransactionCommon *common, bool inner) {
 	if (!common->has_network) {
@@ -697,9 +698,30 @@ bool nem_fsmMultisig(nem_transaction_ctx *context, const NEMTransactionCommon *c
 	return true;
 }
 
+static int nem_mosaicDefinitionCompare(const NEMMosaicDefinition *definition, const char *namespace, const char *mosaic) {
+	int r = strcmp(definition->namespace, namespace);
+	return r != 0 ? r : strcmp(definition->mosaic, mosaic);
+}
+
 const NEMMosaicDefinition *nem_mosaicByName(const char *namespace, const char *mosaic, uint8_t network) {
-	for (size_t i = 0; i < NEM_MOSAIC_DEFINITIONS_COUNT; i++) {
-		const NEMMosaicDefinition *definition = &NEM_MOSAIC_DEFINITIONS[i];
+	// Find the first definition with this name, then check the networks of
+	// all definitions sharing it
+	size_t lo = 0, hi = NEM_MOSAIC_DEFINITIONS_COUNT;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (nem_mosaicDefinitionCompare(&NEM_MOSAIC_DEFINITIONS[NEM_MOSAIC_DEFINITIONS_SORTED[mid]], namespace, mosaic) < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	for (; lo < NEM_MOSAIC_DEFINITIONS_COUNT; lo++) {
+		const NEMMosaicDefinition *definition = &NEM_MOSAIC_DEFINITIONS[NEM_MOSAIC_DEFINITIONS_SORTED[lo]];
+
+		if (nem_mosaicDefinitionCompare(definition, namespace, mosaic) != 0) {
+			break;
+		}
 
 		if (nem_mosaicMatches(definition, namespace, mosaic, network)) {
 			return definition;
@@ -733,48 +755,74 @@ size_t nem_canonicalizeMosaics(NEMMosaic *mosaics, size_t mosaics_count) {
 		return mosaics_count;
 	}
 
-	size_t actual_count = 0;
-
-	bool skip[mosaics_count];
-	memset(skip, 0, sizeof(skip));
-
-	// Merge duplicates
+	// Sort an index permutation (bottom-up merge sort), the mosaics
+	// themselves are moved only once at the end
+	size_t order[mosaics_count], temp[mosaics_count];
 	for (size_t i = 0; i < mosaics_count; i++) {
-		if (skip[i]) continue;
+		order[i] = i;
+	}
 
-		NEMMosaic *mosaic = &mosaics[actual_count];
+	for (size_t width = 1; width < mosaics_count; width *= 2) {
+		for (size_t lo = 0; lo < mosaics_count; lo += 2 * width) {
+			size_t mid = MIN(lo + width, mosaics_count);
+			size_t hi = MIN(lo + 2 * width, mosaics_count);
+			size_t i = lo, j = mid, k = lo;
 
-		if (actual_count++ != i) {
-			memcpy(mosaic, &mosaics[i], sizeof(NEMMosaic));
+			while (i < mid && j < hi) {
+				if (nem_mosaicCompare(&mosaics[order[j]], &mosaics[order[i]]) < 0) {
+					temp[k++] = order[j++];
+				} else {
+					temp[k++] = order[i++];
+				}
+			}
+			while (i < mid) temp[k++] = order[i++];
+			while (j < hi) temp[k++] = order[j++];
 		}
+		memcpy(order, temp, sizeof(order));
+	}
 
-		for (size_t j = i + 1; j < mosaics_count; j++) {
-			if (skip[j]) continue;
-
-			const NEMMosaic *new_mosaic = &mosaics[j];
+	// Merge duplicates, which are now adjacent, into the first of each run
+	size_t actual_count = 0;
+	for (size_t i = 0; i < mosaics_count; i++) {
+		if (actual_count > 0 && nem_mosaicCompare(&mosaics[order[actual_count - 1]], &mosaics[order[i]]) == 0) {
+			mosaics[order[actual_count - 1]].quantity += mosaics[order[i]].quantity;
+		} else {
+			order[actual_count++] = order[i];
+		}
+	}
 
-			if (nem_mosaicCompare(mosaic, new_mosaic) == 0) {
-				skip[j] = true;
-				mosaic->quantity += new_mosaic->quantity;
-			}
+	// Complete the permutation with the merged away mosaics, then apply it
+	// by following its cycles: every mosaic is copied once, plus one spare
+	// copy per cycle
+	bool done[mosaics_count];
+	memset(done, 0, sizeof(done));
+	for (size_t i = 0; i < actual_count; i++) {
+		done[order[i]] = true;
+	}
+	for (size_t i = 0, k = actual_count; i < mosaics_count; i++) {
+		if (!done[i]) {
+			order[k++] = i;
 		}
 	}
 
-	NEMMosaic temp;
+	memset(done, 0, sizeof(done));
+	for (size_t i = 0; i < mosaics_count; i++) {
+		if (done[i]) continue;
 
-	// Sort mosaics
-	for (size_t i = 0; i < actual_count - 1; i++) {
-		NEMMosaic *a = &mosaics[i];
+		done[i] = true;
+		if (order[i] == i) continue;
 
-		for (size_t j = i + 1; j < actual_count; j++) {
-			NEMMosaic *b = &mosaics[j];
+		NEMMosaic spare;
+		memcpy(&spare, &mosaics[i], sizeof(NEMMosaic));
 
-			if (nem_mosaicCompare(a, b) > 0) {
-				memcpy(&temp, a, sizeof(NEMMosaic));
-				memcpy(a, b, sizeof(NEMMosaic));
-				memcpy(b, &temp, sizeof(NEMMosaic));
-			}
+		size_t dst = i;
+		while (order[dst] != i) {
+			size_t src = order[dst];
+			memcpy(&mosaics[dst], &mosaics[src], sizeof(NEMMosaic));
+			done[src] = true;
+			dst = src;
 		}
+		memcpy(&mosaics[dst], &spare, sizeof(NEMMosaic));
 	}
 
 	return actual_count;
@@ -27,6 +27,9 @@ HEADER_TEMPLATE = """
 extern const NEMMosaicDefinition NEM_MOSAIC_DEFINITIONS[NEM_MOSAIC_DEFINITIONS_COUNT];
 extern const NEMMosaicDefinition *NEM_MOSAIC_DEFINITION_XEM;
 
+// indices into NEM_MOSAIC_DEFINITIONS, sorted by namespace and mosaic
+extern const uint16_t NEM_MOSAIC_DEFINITIONS_SORTED[NEM_MOSAIC_DEFINITIONS_COUNT];
+
 #endif
 """.lstrip()
 
@@ -38,6 +41,8 @@ CODE_TEMPLATE = """
 const NEMMosaicDefinition NEM_MOSAIC_DEFINITIONS[NEM_MOSAIC_DEFINITIONS_COUNT] = {code};
 
 const NEMMosaicDefinition *NEM_MOSAIC_DEFINITION_XEM = NEM_MOSAIC_DEFINITIONS;
+
+const uint16_t NEM_MOSAIC_DEFINITIONS_SORTED[NEM_MOSAIC_DEFINITIONS_COUNT] = {sorted};
 """.lstrip()
 
 def format_primitive(value):
@@ -88,6 +93,11 @@ def message_to_struct(_message, proto):
 def format_message(message, proto):
     return format_struct(message_to_struct(message, proto))
 
+def sorted_indices(messages):
+    # byte-wise order, matching strcmp() in nem_mosaicByName()
+    key = lambda i: (messages[i]["namespace"].encode("utf-8"), messages[i]["mosaic"].encode("utf-8"), i)
+    return sorted(range(len(messages)), key=key)
+
 def format_messages(messages, proto):
     return "{" + ",\n".join(
         format_message(message, proto) for message in messages
@@ -102,4 +112,7 @@ if __name__ == "__main__":
         f.write(HEADER_TEMPLATE.format(count=format_primitive(len(messages))))
 
     with open("nem_mosaics.c", "w+") as f:
-        f.write(CODE_TEMPLATE.format(code=format_messages(messages, types.NEMMosaicDefinition)))
+        f.write(CODE_TEMPLATE.format(
+            code=format_messages(messages, types.NEMMosaicDefinition),
+            sorted=format_primitive(sorted_indices(messages)),
+        ))
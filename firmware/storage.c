@@ -41,6 +41,7 @@
 #include "usb.h"
 #include "gettext.h"
 #include "u2f.h"
+#include "fsm.h"
 
 /* magic constant to check validity of storage block */
 static const uint32_t storage_magic = 0x726f7473;   // 'stor' as uint32_t
@@ -268,6 +269,7 @@ void session_clear(bool clear_pin)
 	if (clear_pin) {
 		sessionPinCached = false;
 	}
+	fsm_clearSessionCaches();
 }
 
 static uint32_t storage_flash_words(uint32_t addr, const uint32_t *src, int nwords) {
@@ -400,6 +402,7 @@ static void storage_commit_locked(bool update)
 void storage_clear_update(void)
 {
 	memset(&storageUpdate, 0, sizeof(storageUpdate));
+	layoutHomeInvalidate();
 }
 
 void storage_update(void)
@@ -819,6 +822,7 @@ void storage_setNeedsBackup(bool needs_backup)
 {
 	storageUpdate.has_needs_backup = true;
 	storageUpdate.needs_backup = needs_backup;
+	layoutHomeInvalidate();
 }
 
 void storage_applyFlags(uint32_t flags)
@@ -33,6 +33,7 @@
 #include "hmac.h"
 #include "util.h"
 #include "gettext.h"
+#include "timer.h"
 
 #include "u2f/u2f.h"
 #include "u2f/u2f_hid.h"
@@ -42,15 +43,29 @@
 
 // About 1/2 Second according to values used in protect.c
 #define U2F_TIMEOUT (800000/2)
-#define U2F_OUT_PKT_BUFFER_LEN 128
 
-// Initialise without a cid
+// Number of frames needed to carry a message of len bytes
+#define U2F_FRAMES(len) (1 + ((len) > 57 ? ((len) - 57 + 58) / 59 : 0))
+
+// Slots kept for the INIT and error replies sent while queue_u2f_pkt
+// waits for the host, one per channel
+#define U2F_OUT_RESERVED U2F_MAX_CHANNELS
+
+// Room for the largest register response plus the reserved slots;
+// anything larger makes queue_u2f_pkt wait for the host instead.
+#define U2F_OUT_PKT_BUFFER_LEN (U2F_FRAMES(sizeof(U2F_REGISTER_RESP) + 2) + U2F_OUT_RESERVED + 1)
+
+// Channel the current response is addressed to
 static uint32_t cid = 0;
 
 // Circular Output buffer
 static uint32_t u2f_out_start = 0;
 static uint32_t u2f_out_end = 0;
 static uint8_t u2f_out_packets[U2F_OUT_PKT_BUFFER_LEN][HID_RPT_SIZE];
+static U2F_OutStats u2f_out_stats;
+
+// Set while queue_u2f_pkt waits for the host to drain the buffer
+static bool u2f_out_wait = false;
 
 #define U2F_PUBKEY_LEN 65
 #define KEY_PATH_LEN 32
@@ -91,148 +106,374 @@ typedef struct {
 
 static uint32_t dialog_timeout = 0;
 
-uint32_t next_cid(void)
-{
-	// extremely unlikely but hey
-	do {
-		cid = random32();
-	} while (cid == 0 || cid == CID_BROADCAST);
-	return cid;
-}
+// Channel the register/authenticate dialog on the display belongs to
+static uint32_t dialog_cid = 0;
+
+// Largest message the reassembly pool can hold (init frame + 127 cont frames)
+#define U2F_MAX_MSG_LEN (57+127*59)
 
 typedef struct {
-	uint8_t buf[57+127*59];
+	uint8_t *buf;
 	uint8_t *buf_ptr;
+	uint32_t size;
 	uint32_t len;
 	uint8_t seq;
 	uint8_t cmd;
 } U2F_ReadBuffer;
 
-U2F_ReadBuffer *reader;
+typedef struct {
+	uint32_t cid;
+	U2F_ReadBuffer reader;
+	uint32_t timeout;
+	uint32_t last_used;
+	uint32_t queued_at;
+	bool queued;
+	bool dispatching;
+	U2F_ChannelStats stats;
+} U2F_Channel;
 
-void u2fhid_read(char tiny, const U2FHID_FRAME *f)
+static U2F_Channel channels[U2F_MAX_CHANNELS];
+
+// Completed requests waiting for the dispatch loop, in arrival order
+static U2F_Channel *u2f_queue[U2F_MAX_CHANNELS];
+static uint32_t u2f_queue_len = 0;
+
+// Set while u2fhid_process serves the queue
+static bool u2f_processing = false;
+
+// Shared reassembly pool, channels reserve MSG_LEN rounded up to whole frames
+static uint8_t u2f_pool[U2F_MAX_MSG_LEN];
+
+static U2F_Channel *u2f_channel_find(uint32_t fcid)
 {
-	// Always handle init packets directly
-	if (f->init.cmd == U2FHID_INIT) {
-		u2fhid_init(f);
-		if (tiny && reader && f->cid == cid) {
-			// abort current channel
-			reader->cmd = 0;
-			reader->len = 0;
-			reader->seq = 255;
+	for (int i = 0; i < U2F_MAX_CHANNELS; i++) {
+		if (channels[i].cid == fcid) {
+			return &channels[i];
 		}
-		return;
 	}
+	return NULL;
+}
 
-	if (tiny) {
-		// read continue packet
-		if (reader == 0 || cid != f->cid) {
-			send_u2fhid_error(f->cid, ERR_CHANNEL_BUSY);
-			return;
+static U2F_Channel *u2f_channel_get(uint32_t fcid)
+{
+	U2F_Channel *ch = u2f_channel_find(fcid);
+	if (ch) {
+		return ch;
+	}
+
+	// Take over an unused slot or the least recently used idle one
+	const uint32_t now = timer_ms();
+	for (int i = 0; i < U2F_MAX_CHANNELS; i++) {
+		U2F_Channel *c = &channels[i];
+		if (c->reader.buf || c->queued) {
+			continue;
 		}
+		if (c->cid == 0) {
+			ch = c;
+			break;
+		}
+		if (!ch || (now - c->last_used) > (now - ch->last_used)) {
+			ch = c;
+		}
+	}
+	if (!ch) {
+		return NULL;
+	}
 
-		if ((f->type & TYPE_INIT) && reader->seq == 255) {
-			u2fhid_init_cmd(f);
-			return;
+	memset(ch, 0, sizeof(U2F_Channel));
+	ch->cid = fcid;
+	ch->stats.cid = fcid;
+	return ch;
+}
+
+static uint8_t *u2f_pool_alloc(uint32_t size)
+{
+	// First fit: try the pool start and the end of every live region
+	for (int i = -1; i < U2F_MAX_CHANNELS; i++) {
+		uint32_t offset = 0;
+		if (i >= 0) {
+			const U2F_ReadBuffer *r = &channels[i].reader;
+			if (!r->buf) {
+				continue;
+			}
+			offset = (r->buf - u2f_pool) + r->size;
+		}
+		if (offset + size > sizeof(u2f_pool)) {
+			continue;
 		}
 
-		if (reader->seq != f->cont.seq) {
-			send_u2fhid_error(f->cid, ERR_INVALID_SEQ);
-			reader->cmd = 0;
-			reader->len = 0;
-			reader->seq = 255;
-			return;
+		bool fits = true;
+		for (int j = 0; j < U2F_MAX_CHANNELS; j++) {
+			const U2F_ReadBuffer *r = &channels[j].reader;
+			if (!r->buf) {
+				continue;
+			}
+			const uint32_t start = r->buf - u2f_pool;
+			if (offset < start + r->size && start < offset + size) {
+				fits = false;
+				break;
+			}
+		}
+		if (fits) {
+			return u2f_pool + offset;
 		}
+	}
+	return NULL;
+}
 
-		// check out of bounds
-		if ((reader->buf_ptr - reader->buf) >= (signed) reader->len
-			|| (reader->buf_ptr + sizeof(f->cont.data) - reader->buf) > (signed) sizeof(reader->buf))
-			return;
-		reader->seq++;
-		memcpy(reader->buf_ptr, f->cont.data, sizeof(f->cont.data));
-		reader->buf_ptr += sizeof(f->cont.data);
+static void u2f_channel_reset(U2F_Channel *ch)
+{
+	if (ch->queued) {
+		for (uint32_t i = 0; i < u2f_queue_len; i++) {
+			if (u2f_queue[i] == ch) {
+				memmove(&u2f_queue[i], &u2f_queue[i + 1], (u2f_queue_len - i - 1) * sizeof(u2f_queue[0]));
+				u2f_queue_len--;
+				break;
+			}
+		}
+		ch->queued = false;
+	}
+	memset(&ch->reader, 0, sizeof(ch->reader));
+}
+
+uint32_t next_cid(void)
+{
+	uint32_t new_cid;
+	// extremely unlikely but hey
+	do {
+		new_cid = random32();
+	} while (new_cid == 0 || new_cid == CID_BROADCAST || u2f_channel_find(new_cid));
+	return new_cid;
+}
+
+const U2F_ChannelStats *u2fhid_stats(uint8_t index)
+{
+	if (index >= U2F_MAX_CHANNELS || channels[index].cid == 0) {
+		return NULL;
+	}
+	return &channels[index].stats;
+}
+
+static void u2fhid_dispatch(U2F_Channel *ch)
+{
+	// Replies go to the channel being served
+	const uint32_t prev_cid = cid;
+	cid = ch->cid;
+	ch->dispatching = true;
+
+	switch (ch->reader.cmd) {
+	case U2FHID_PING:
+		u2fhid_ping(ch->reader.buf, ch->reader.len);
+		break;
+	case U2FHID_MSG:
+		u2fhid_msg((APDU *)ch->reader.buf, ch->reader.len);
+		break;
+	case U2FHID_WINK:
+		u2fhid_wink(ch->reader.buf, ch->reader.len);
+		break;
+	default:
+		send_u2fhid_error(cid, ERR_INVALID_CMD);
+		break;
+	}
+
+	ch->stats.requests++;
+	ch->dispatching = false;
+	u2f_channel_reset(ch);
+	cid = prev_cid;
+}
+
+static void u2f_channel_complete(U2F_Channel *ch)
+{
+	if ((ch->reader.buf_ptr - ch->reader.buf) < (signed)ch->reader.len) {
 		return;
 	}
 
-	u2fhid_read_start(f);
+	switch (ch->reader.cmd) {
+	case U2FHID_PING:
+	case U2FHID_WINK:
+		// Never wait for the user, answer right away unless a
+		// response is already waiting for room in the output buffer
+		if (!u2f_out_wait) {
+			u2fhid_dispatch(ch);
+			break;
+		}
+		// fall through
+	default:
+		ch->queued = true;
+		ch->queued_at = timer_ms();
+		u2f_queue[u2f_queue_len++] = ch;
+		break;
+	}
+}
+
+void u2fhid_read(char tiny, const U2FHID_FRAME *f)
+{
+	// Always handle init packets directly
+	if (f->init.cmd == U2FHID_INIT) {
+		u2fhid_init(f);
+		U2F_Channel *ch = u2f_channel_find(f->cid);
+		if (ch && !ch->dispatching) {
+			// abort current transaction on this channel
+			u2f_channel_reset(ch);
+		}
+	} else if (f->type & TYPE_INIT) {
+		u2fhid_init_cmd(f);
+	} else {
+		u2fhid_read_cont(f);
+	}
+
+	if (!tiny) {
+		u2fhid_process();
+	} else if (!u2f_processing) {
+		// Nothing serves the queue while the firmware is busy in tiny
+		// mode, so refuse completed requests and let the host retry
+		while (u2f_queue_len > 0) {
+			U2F_Channel *ch = u2f_queue[0];
+			ch->stats.busy_errors++;
+			send_u2fhid_error(ch->cid, ERR_CHANNEL_BUSY);
+			u2f_channel_reset(ch);
+		}
+	}
 }
 
 void u2fhid_init_cmd(const U2FHID_FRAME *f) {
+	// Broadcast is reserved for init
+	if (f->cid == CID_BROADCAST || f->cid == 0) {
+		send_u2fhid_error(f->cid, ERR_INVALID_CID);
+		return;
+	}
+
+	if ((unsigned)MSG_LEN(*f) > U2F_MAX_MSG_LEN) {
+		send_u2fhid_error(f->cid, ERR_INVALID_LEN);
+		return;
+	}
+
+	U2F_Channel *ch = u2f_channel_get(f->cid);
+	if (!ch) {
+		debugLog(0, "", "u2f no free channel");
+		send_u2fhid_error(f->cid, ERR_CHANNEL_BUSY);
+		return;
+	}
+	ch->last_used = timer_ms();
+
+	if (ch->queued || ch->dispatching) {
+		// previous request on this channel not served yet
+		ch->stats.busy_errors++;
+		send_u2fhid_error(f->cid, ERR_CHANNEL_BUSY);
+		return;
+	}
+
+	if (ch->reader.buf) {
+		// init packet in the middle of a message
+		send_u2fhid_error(f->cid, ERR_INVALID_SEQ);
+		u2f_channel_reset(ch);
+		return;
+	}
+
+	const uint32_t len = MSG_LEN(*f);
+	uint32_t size = sizeof(f->init.data);
+	if (len > size) {
+		size += (len - size + sizeof(f->cont.data) - 1) / sizeof(f->cont.data) * sizeof(f->cont.data);
+	}
+
+	U2F_ReadBuffer *reader = &ch->reader;
+	reader->buf = u2f_pool_alloc(size);
+	if (!reader->buf) {
+		ch->stats.busy_errors++;
+		send_u2fhid_error(f->cid, ERR_CHANNEL_BUSY);
+		return;
+	}
+	reader->size = size;
 	reader->seq = 0;
 	reader->buf_ptr = reader->buf;
-	reader->len = MSG_LEN(*f);
+	reader->len = len;
 	reader->cmd = f->type;
 	memcpy(reader->buf_ptr, f->init.data, sizeof(f->init.data));
 	reader->buf_ptr += sizeof(f->init.data);
-	cid = f->cid;
+	ch->timeout = U2F_TIMEOUT;
+
+	u2f_channel_complete(ch);
 }
 
-void u2fhid_read_start(const U2FHID_FRAME *f) {
-	U2F_ReadBuffer readbuffer;
-	if (!(f->type & TYPE_INIT)) {
+void u2fhid_read_cont(const U2FHID_FRAME *f)
+{
+	U2F_Channel *ch = u2f_channel_find(f->cid);
+	if (!ch || !ch->reader.buf || ch->queued || ch->dispatching) {
+		// no message in progress on this channel
 		return;
 	}
+	ch->last_used = timer_ms();
 
-	// Broadcast is reserved for init
-	if (f->cid == CID_BROADCAST || f->cid == 0) {
-		send_u2fhid_error(f->cid, ERR_INVALID_CID);
+	U2F_ReadBuffer *reader = &ch->reader;
+	if (reader->seq != f->cont.seq) {
+		send_u2fhid_error(f->cid, ERR_INVALID_SEQ);
+		u2f_channel_reset(ch);
 		return;
 	}
 
-	if ((unsigned)MSG_LEN(*f) > sizeof(reader->buf)) {
-		send_u2fhid_error(f->cid, ERR_INVALID_LEN);
+	// check out of bounds
+	if ((reader->buf_ptr - reader->buf) >= (signed) reader->len
+		|| (reader->buf_ptr + sizeof(f->cont.data) - reader->buf) > (signed) reader->size)
 		return;
-	}
+	reader->seq++;
+	memcpy(reader->buf_ptr, f->cont.data, sizeof(f->cont.data));
+	reader->buf_ptr += sizeof(f->cont.data);
+	ch->timeout = U2F_TIMEOUT;
+
+	u2f_channel_complete(ch);
+}
 
-	reader = &readbuffer;
-	u2fhid_init_cmd(f);
+void u2fhid_process(void)
+{
+	bool pending = u2f_queue_len > 0;
+	for (int i = 0; i < U2F_MAX_CHANNELS; i++) {
+		pending |= (channels[i].reader.buf != NULL);
+	}
+	if (!pending) {
+		return;
+	}
 
 	usbTiny(1);
-	for(;;) {
+	u2f_processing = true;
+	for (;;) {
+		if (u2f_queue_len > 0) {
+			U2F_Channel *ch = u2f_queue[0];
+			memmove(&u2f_queue[0], &u2f_queue[1], (u2f_queue_len - 1) * sizeof(u2f_queue[0]));
+			u2f_queue_len--;
+			ch->queued = false;
+
+			const uint32_t wait = timer_ms() - ch->queued_at;
+			ch->stats.queue_wait_total += wait;
+			if (wait > ch->stats.queue_wait_max) {
+				ch->stats.queue_wait_max = wait;
+			}
+
+			u2fhid_dispatch(ch);
+			continue;
+		}
+
 		// Do we need to wait for more data
-		while ((reader->buf_ptr - reader->buf) < (signed)reader->len) {
-			uint8_t lastseq = reader->seq;
-			uint8_t lastcmd = reader->cmd;
-			int counter = U2F_TIMEOUT;
-			while (reader->seq == lastseq && reader->cmd == lastcmd) {
-				if (counter-- == 0) {
-					// timeout
-					send_u2fhid_error(cid, ERR_MSG_TIMEOUT);
-					cid = 0;
-					reader = 0;
-					usbTiny(0);
-					layoutHome();
-					return;
-				}
-				usbPoll();
+		bool reading = false;
+		for (int i = 0; i < U2F_MAX_CHANNELS; i++) {
+			U2F_Channel *ch = &channels[i];
+			if (!ch->reader.buf) {
+				continue;
+			}
+			if (ch->timeout-- == 0) {
+				send_u2fhid_error(ch->cid, ERR_MSG_TIMEOUT);
+				u2f_channel_reset(ch);
+				continue;
 			}
+			reading = true;
 		}
 
-		// We have all the data
-		switch (reader->cmd) {
-		case 0:
-			// message was aborted by init
-			break;
-		case U2FHID_PING:
-			u2fhid_ping(reader->buf, reader->len);
-			break;
-		case U2FHID_MSG:
-			u2fhid_msg((APDU *)reader->buf, reader->len);
-			break;
-		case U2FHID_WINK:
-			u2fhid_wink(reader->buf, reader->len);
-			break;
-		default:
-			send_u2fhid_error(cid, ERR_INVALID_CMD);
+		if (!reading && dialog_timeout == 0) {
 			break;
 		}
 
 		// wait for next commmand/ button press
-		reader->cmd = 0;
-		reader->seq = 255;
-		while (dialog_timeout > 0 && reader->cmd == 0) {
+		if (dialog_timeout > 0) {
 			dialog_timeout--;
-			usbPoll(); // may trigger new request
 			buttonUpdate();
 			if (button.YesUp &&
 				(last_req_state == AUTH || last_req_state == REG)) {
@@ -241,16 +482,15 @@ void u2fhid_read_start(const U2FHID_FRAME *f) {
 				dialog_timeout = 10 * U2F_TIMEOUT;
 			}
 		}
-
-		if (reader->cmd == 0) {
-			last_req_state = INIT;
-			cid = 0;
-			reader = 0;
-			usbTiny(0);
-			layoutHome();
-			return;
-		}
+		usbPoll(); // may trigger new request
 	}
+
+	last_req_state = INIT;
+	dialog_cid = 0;
+	cid = 0;
+	u2f_processing = false;
+	usbTiny(0);
+	layoutHome();
 }
 
 void u2fhid_ping(const uint8_t *buf, uint32_t len)
@@ -267,7 +507,7 @@ void u2fhid_wink(const uint8_t *buf, uint32_t len)
 	if (len > 0)
 		return send_u2fhid_error(cid, ERR_INVALID_LEN);
 
-	if (dialog_timeout > 0)
+	if (dialog_timeout > 0 && cid == dialog_cid)
 		dialog_timeout = U2F_TIMEOUT;
 
 	U2FHID_FRAME f;
@@ -309,16 +549,47 @@ void u2fhid_init(const U2FHID_FRAME *in)
 	queue_u2f_pkt(&f);
 }
 
+static uint32_t u2f_out_used(void)
+{
+	return (u2f_out_end + U2F_OUT_PKT_BUFFER_LEN - u2f_out_start) % U2F_OUT_PKT_BUFFER_LEN;
+}
+
 void queue_u2f_pkt(const U2FHID_FRAME *u2f_pkt)
 {
 	// debugLog(0, "", "u2f_write_pkt");
-	uint32_t next = (u2f_out_end + 1) % U2F_OUT_PKT_BUFFER_LEN;
-	if (u2f_out_start == next) {
+	// Replies queued while another sender waits for the host (INIT
+	// and errors, see u2f_channel_complete) may use the reserved slots
+	const uint32_t limit = U2F_OUT_PKT_BUFFER_LEN - 1 - (u2f_out_wait ? 0 : U2F_OUT_RESERVED);
+	if (u2f_out_used() >= limit && !u2f_out_wait) {
+		// Let the host drain the buffer; incoming frames are only
+		// reassembled meanwhile, see u2f_channel_complete
+		u2f_out_stats.stalls++;
+		u2f_out_wait = true;
+		char oldtiny = usbTiny(1);
+		int counter = U2F_TIMEOUT;
+		while (u2f_out_used() >= limit && counter-- > 0) {
+			usbPoll();
+		}
+		usbTiny(oldtiny);
+		u2f_out_wait = false;
+	}
+	if (u2f_out_used() >= limit) {
 		debugLog(0, "", "u2f_write_pkt full");
+		u2f_out_stats.overflows++;
 		return; // Buffer full :(
 	}
 	memcpy(u2f_out_packets[u2f_out_end], u2f_pkt, HID_RPT_SIZE);
-	u2f_out_end = next;
+	u2f_out_end = (u2f_out_end + 1) % U2F_OUT_PKT_BUFFER_LEN;
+
+	const uint32_t used = u2f_out_used();
+	if (used > u2f_out_stats.high_watermark) {
+		u2f_out_stats.high_watermark = used;
+	}
+}
+
+const U2F_OutStats *u2f_out_get_stats(void)
+{
+	return &u2f_out_stats;
 }
 
 uint8_t *u2f_out_data(void)
@@ -529,6 +800,17 @@ static const HDNode *validateKeyHandle(const uint8_t app_id[], const uint8_t key
 }
 
 
+// There is only one dialog, so while it is pending, requests that need
+// the user from other channels are refused and retried by the host
+static bool u2f_dialog_busy(void)
+{
+	if (dialog_timeout > 0 && cid != dialog_cid) {
+		send_u2fhid_error(cid, ERR_CHANNEL_BUSY);
+		return true;
+	}
+	return false;
+}
+
 void u2f_register(const APDU *a)
 {
 	static U2F_REGISTER_REQ last_req;
@@ -547,6 +829,10 @@ void u2f_register(const APDU *a)
 		return;
 	}
 
+	if (u2f_dialog_busy()) {
+		return;
+	}
+
 	// If this request is different from last request, reset state machine
 	if (memcmp(&last_req, req, sizeof(last_req)) != 0) {
 		memcpy(&last_req, req, sizeof(last_req));
@@ -566,6 +852,7 @@ void u2f_register(const APDU *a)
 			layoutU2FDialog(_("Register"), appname, appicon);
 		}
 		last_req_state = REG;
+		dialog_cid = cid;
 	}
 
 	// Still awaiting Keypress
@@ -686,6 +973,10 @@ void u2f_authenticate(const APDU *a)
 
 	debugLog(0, "", "u2f authenticate enforce");
 
+	if (u2f_dialog_busy()) {
+		return;
+	}
+
 	if (memcmp(&last_req, req, sizeof(last_req)) != 0) {
 		memcpy(&last_req, req, sizeof(last_req));
 		last_req_state = INIT;
@@ -699,6 +990,7 @@ void u2f_authenticate(const APDU *a)
 		getReadableAppId(req->appId, &appname, &appicon);
 		layoutU2FDialog(_("Authenticate"), appname, appicon);
 		last_req_state = AUTH;
+		dialog_cid = cid;
 	}
 
 	// Awaiting Keypress
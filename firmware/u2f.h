@@ -35,9 +35,27 @@ typedef struct {
 
 #define APDU_LEN(A) (uint32_t)(((A).lc1 << 16) + ((A).lc2 << 8) + ((A).lc3))
 
+// Number of U2FHID channels served concurrently
+#define U2F_MAX_CHANNELS 4
+
+typedef struct {
+	uint32_t cid;
+	uint32_t requests;
+	uint32_t busy_errors;
+	uint32_t queue_wait_total;	// ms spent queued behind other channels
+	uint32_t queue_wait_max;
+} U2F_ChannelStats;
+
+typedef struct {
+	uint32_t stalls;	// times a sender waited for the host to drain
+	uint32_t overflows;	// frames dropped after waiting in vain
+	uint32_t high_watermark;	// most frames queued at once
+} U2F_OutStats;
+
 void u2fhid_read(char tiny, const U2FHID_FRAME *buf);
 void u2fhid_init_cmd(const U2FHID_FRAME *f);
-void u2fhid_read_start(const U2FHID_FRAME *f);
+void u2fhid_read_cont(const U2FHID_FRAME *f);
+void u2fhid_process(void);
 bool u2fhid_write(uint8_t *buf);
 void u2fhid_init(const U2FHID_FRAME *in);
 void u2fhid_ping(const uint8_t *buf, uint32_t len);
@@ -46,8 +64,10 @@ void u2fhid_sync(const uint8_t *buf, uint32_t len);
 void u2fhid_lock(const uint8_t *buf, uint32_t len);
 void u2fhid_msg(const APDU *a, uint32_t len);
 void queue_u2f_pkt(const U2FHID_FRAME *u2f_pkt);
+const U2F_ChannelStats *u2fhid_stats(uint8_t index);
 
 uint8_t *u2f_out_data(void);
+const U2F_OutStats *u2f_out_get_stats(void);
 void u2f_register(const APDU *a);
 void u2f_version(const APDU *a);
 void u2f_authenticate(const APDU *a);
@@ -18,24 +18,59 @@
  */
 
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 
 #include "usb.h"
 
 #include "messages.h"
+#include "oled.h"
+#include "layout.h"
 #include "timer.h"
+#include "u2f.h"
 
 static volatile char tiny = 0;
 
+/*
+ * Set TREZOR_U2F_STATS to print the U2FHID channel and output buffer
+ * counters on exit.
+ */
+static void u2fPrintStats(void) {
+	const U2F_OutStats *out = u2f_out_get_stats();
+	fprintf(stderr, "u2f: %u stalls, %u overflows, %u frames queued at most\n",
+		out->stalls, out->overflows, out->high_watermark);
+
+	for (uint8_t i = 0; i < U2F_MAX_CHANNELS; i++) {
+		const U2F_ChannelStats *ch = u2fhid_stats(i);
+		if (ch == NULL) {
+			continue;
+		}
+		fprintf(stderr, "u2f: channel %08x: %u requests, %u busy, %.1f ms queued on average, %u ms at most\n",
+			ch->cid, ch->requests, ch->busy_errors,
+			ch->requests ? (double) ch->queue_wait_total / ch->requests : 0.0,
+			ch->queue_wait_max);
+	}
+}
+
 void usbInit(void) {
 	emulatorSocketInit();
+
+	if (getenv("TREZOR_U2F_STATS")) {
+		atexit(u2fPrintStats);
+	}
 }
 
 void usbPoll(void) {
 	emulatorPoll();
+	oledAnimate();
+	layoutProgressFlush();
 
-	static uint8_t buffer[64];
-	if (emulatorSocketRead(buffer, sizeof(buffer)) > 0) {
-		if (!tiny) {
+	static uint8_t buffer[64] __attribute__ ((aligned(4)));
+	int iface = EMULATOR_IFACE_MAIN;
+	if (emulatorSocketRead(&iface, buffer, sizeof(buffer)) > 0) {
+		if (iface == EMULATOR_IFACE_U2F) {
+			u2fhid_read(tiny, (const U2FHID_FRAME *) (void *) buffer);
+		} else if (!tiny) {
 			msg_read(buffer, sizeof(buffer));
 		} else {
 			msg_read_tiny(buffer, sizeof(buffer));
@@ -51,7 +86,12 @@ void usbPoll(void) {
 #endif
 
 	if (data != NULL) {
-		emulatorSocketWrite(data, 64);
+		emulatorSocketWrite(EMULATOR_IFACE_MAIN, data, 64);
+	}
+
+	data = u2f_out_data();
+	if (data != NULL) {
+		emulatorSocketWrite(EMULATOR_IFACE_U2F, data, 64);
 	}
 }
 
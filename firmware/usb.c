@@ -28,6 +28,8 @@
 #include "storage.h"
 #include "util.h"
 #include "timer.h"
+#include "oled.h"
+#include "layout.h"
 
 #define USB_INTERFACE_INDEX_MAIN 0
 #if DEBUG_LINK
@@ -412,6 +414,10 @@ void usbPoll(void)
 	static const uint8_t *data;
 	// poll read buffer
 	usbd_poll(usbd_dev);
+	// advance a running screen animation
+	oledAnimate();
+	// show a progress frame held back by the frame rate cap
+	layoutProgressFlush();
 	// write pending data
 	data = msg_out_data();
 	if (data) {
@@ -450,5 +456,7 @@ void usbSleep(uint32_t millis)
 
 	while ((timer_ms() - start) < millis) {
 		usbd_poll(usbd_dev);
+		oledAnimate();
+		layoutProgressFlush();
 	}
 }
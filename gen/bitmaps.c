@@ -1,69 +1,69 @@
 #include "bitmaps.h"
 
-const uint8_t bmp_digit0_data[] = { 0xff, 0xff, 0xf8, 0x1f, 0xf0, 0x0f, 0xe1, 0x87, 0xe1, 0x87, 0xe1, 0x87, 0xe1, 0x87, 0xe1, 0x87, 0xe1, 0x87, 0xe1, 0x87, 0xe1, 0x87, 0xe1, 0x87, 0xe1, 0x87, 0xf0, 0x0f, 0xf8, 0x1f, 0xff, 0xff, };
-const uint8_t bmp_digit1_data[] = { 0xff, 0xff, 0xfc, 0x3f, 0xf8, 0x3f, 0xf0, 0x3f, 0xf0, 0x3f, 0xfc, 0x3f, 0xfc, 0x3f, 0xfc, 0x3f, 0xfc, 0x3f, 0xfc, 0x3f, 0xfc, 0x3f, 0xfc, 0x3f, 0xfc, 0x3f, 0xfc, 0x3f, 0xfc, 0x3f, 0xff, 0xff, };
-const uint8_t bmp_digit2_data[] = { 0xff, 0xff, 0xe0, 0x1f, 0xe0, 0x0f, 0xff, 0x87, 0xff, 0x87, 0xff, 0x87, 0xff, 0x87, 0xf8, 0x0f, 0xf0, 0x1f, 0xe1, 0xff, 0xe1, 0xff, 0xe1, 0xff, 0xe1, 0xff, 0xe0, 0x07, 0xe0, 0x07, 0xff, 0xff, };
-const uint8_t bmp_digit3_data[] = { 0xff, 0xff, 0xe0, 0x1f, 0xe0, 0x0f, 0xff, 0x87, 0xff, 0x87, 0xff, 0x87, 0xff, 0x87, 0xf8, 0x0f, 0xf8, 0x0f, 0xff, 0x87, 0xff, 0x87, 0xff, 0x87, 0xff, 0x87, 0xe0, 0x0f, 0xe0, 0x1f, 0xff, 0xff, };
-const uint8_t bmp_digit4_data[] = { 0xff, 0xff, 0xff, 0x0f, 0xfe, 0x0f, 0xfc, 0x0f, 0xf8, 0x0f, 0xf1, 0x0f, 0xe3, 0x0f, 0xc7, 0x0f, 0xcf, 0x0f, 0xc0, 0x0f, 0xc0, 0x0f, 0xff, 0x0f, 0xff, 0x0f, 0xff, 0x0f, 0xff, 0x0f, 0xff, 0xff, };
-const uint8_t bmp_digit5_data[] = { 0xff, 0xff, 0xe0, 0x1f, 0xe0, 0x1f, 0xe7, 0xff, 0xe7, 0xff, 0xe0, 0x1f, 0xe0, 0x0f, 0xff, 0x87, 0xff, 0x87, 0xff, 0x87, 0xff, 0x87, 0xff, 0x87, 0xff, 0x87, 0xe0, 0x0f, 0xe0, 0x1f, 0xff, 0xff, };
-const uint8_t bmp_digit6_data[] = { 0xff, 0xff, 0xf8, 0x1f, 0xf0, 0x1f, 0xe1, 0xff, 0xe1, 0xff, 0xe0, 0x1f, 0xe0, 0x0f, 0xe1, 0x87, 0xe1, 0x87, 0xe1, 0x87, 0xe1, 0x87, 0xe1, 0x87, 0xe1, 0x87, 0xf0, 0x0f, 0xf8, 0x1f, 0xff, 0xff, };
-const uint8_t bmp_digit7_data[] = { 0xff, 0xff, 0xe0, 0x07, 0xe0, 0x07, 0xff, 0x87, 0xff, 0x87, 0xff, 0x0f, 0xfe, 0x1f, 0xfc, 0x1f, 0xfc, 0x3f, 0xf8, 0x7f, 0xf8, 0x7f, 0xf8, 0x7f, 0xf8, 0x7f, 0xf8, 0x7f, 0xf8, 0x7f, 0xff, 0xff, };
-const uint8_t bmp_digit8_data[] = { 0xff, 0xff, 0xf8, 0x1f, 0xf0, 0x0f, 0xe1, 0x87, 0xe1, 0x87, 0xe1, 0x87, 0xe1, 0x87, 0xf0, 0x0f, 0xf0, 0x0f, 0xe1, 0x87, 0xe1, 0x87, 0xe1, 0x87, 0xe1, 0x87, 0xf0, 0x0f, 0xf8, 0x1f, 0xff, 0xff, };
-const uint8_t bmp_digit9_data[] = { 0xff, 0xff, 0xf8, 0x1f, 0xf0, 0x0f, 0xe1, 0x87, 0xe1, 0x87, 0xe1, 0x87, 0xe1, 0x87, 0xe1, 0x87, 0xe1, 0x87, 0xf0, 0x07, 0xf8, 0x07, 0xff, 0x87, 0xff, 0x87, 0xf8, 0x0f, 0xf8, 0x1f, 0xff, 0xff, };
-const uint8_t bmp_gears0_data[] = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xc0, 0x0c, 0x00, 0x00, 0x00, 0x01, 0xe0, 0x1e, 0x00, 0x00, 0x00, 0x01, 0xf0, 0x3e, 0x00, 0x00, 0x00, 0x00, 0xff, 0xfc, 0x00, 0x00, 0x00, 0x00, 0xff, 0xfc, 0x00, 0x00, 0x00, 0x00, 0x7f, 0xf8, 0x00, 0x00, 0x00, 0x00, 0xff, 0xfc, 0x00, 0x00, 0x00, 0x00, 0xff, 0xfc, 0x00, 0x00, 0x00, 0x01, 0xf8, 0x3e, 0x00, 0x00, 0x00, 0x01, 0xf0, 0x1f, 0xe0, 0x00, 0x00, 0x1f, 0xf0, 0x1f, 0xe0, 0x00, 0x00, 0x1f, 0xf0, 0x1f, 0xe0, 0x00, 0x00, 0x1f, 0xf0, 0x1f, 0xc0, 0x00, 0x00, 0x01, 0xf0, 0x1f, 0x00, 0x00, 0x00, 0x00, 0xf8, 0x3e, 0x00, 0x00, 0x00, 0x00, 0xff, 0xfc, 0xc0, 0x18, 0x00, 0x00, 0x7f, 0xfd, 0xe0, 0x3c, 0x00, 0x00, 0x7f, 0xfd, 0xe0, 0x7c, 0x00, 0x00, 0xff, 0xfd, 0xff, 0xf8, 0x00, 0x00, 0xf8, 0x7e, 0xff, 0xf8, 0x00, 0x00, 0xf0, 0x1e, 0xff, 0xf0, 0x00, 0x00, 0x60, 0x0d, 0xff, 0xf8, 0x00, 0x00, 0x00, 0x01, 0xff, 0xfc, 0x00, 0x00, 0x00, 0x03, 0xf0, 0x7c, 0x00, 0x00, 0x00, 0x03, 0xe0, 0x3e, 0x00, 0x00, 0x00, 0x3f, 0xe0, 0x3f, 0xc0, 0x00, 0x00, 0x3f, 0xe0, 0x3f, 0xc0, 0x00, 0x00, 0x3f, 0xe0, 0x3f, 0xc0, 0x00, 0x00, 0x07, 0xe0, 0x3e, 0x00, 0x00, 0x00, 0x01, 0xf0, 0x7c, 0x00, 0x00, 0x00, 0x01, 0xff, 0xf8, 0x00, 0x00, 0x00, 0x00, 0xff, 0xf8, 0x00, 0x00, 0x00, 0x00, 0xff, 0xf8, 0x00, 0x00, 0x00, 0x00, 0xff, 0xf8, 0x00, 0x00, 0x00, 0x01, 0xf0, 0x7c, 0x00, 0x00, 0x00, 0x01, 0xe0, 0x3c, 0x00, 0x00, 0x00, 0x00, 0xc0, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, };
-const uint8_t bmp_gears1_data[] = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x38, 0x00, 0x00, 0x00, 0x00, 0x00, 0x3c, 0x00, 0x00, 0x00, 0x00, 0x00, 0x3c, 0x00, 0x00, 0x00, 0x00, 0x00, 0x3e, 0x07, 0x00, 0x00, 0x00, 0x00, 0x3f, 0xcf, 0x80, 0x00, 0x00, 0x00, 0x3f, 0xff, 0x80, 0x00, 0x00, 0x00, 0x7f, 0xff, 0x00, 0x00, 0x00, 0x00, 0xff, 0xfe, 0x00, 0x00, 0x00, 0x0f, 0xff, 0xfe, 0x00, 0x00, 0x00, 0x1f, 0xf8, 0x3e, 0x00, 0x00, 0x00, 0x1f, 0xf0, 0x1e, 0x00, 0x00, 0x00, 0x1f, 0xf0, 0x1f, 0x00, 0x00, 0x00, 0x07, 0xf0, 0x1f, 0x80, 0x00, 0x00, 0x01, 0xf0, 0x1f, 0xe0, 0x00, 0x00, 0x01, 0xf0, 0x1f, 0xe0, 0x00, 0x00, 0x01, 0xf8, 0x3f, 0xe1, 0xc0, 0x00, 0x00, 0xff, 0xfc, 0xc1, 0xc0, 0x00, 0x00, 0xff, 0xfb, 0x03, 0xc0, 0x00, 0x01, 0xff, 0xf7, 0xc3, 0xc0, 0x00, 0x03, 0xff, 0xf7, 0xff, 0xc0, 0x00, 0x03, 0xc7, 0xf7, 0xff, 0xe0, 0x00, 0x01, 0x81, 0xf3, 0xff, 0xf0, 0x00, 0x00, 0x00, 0xf1, 0xff, 0xff, 0x80, 0x00, 0x00, 0xe1, 0xff, 0xff, 0xc0, 0x00, 0x00, 0x01, 0xf0, 0x7f, 0xc0, 0x00, 0x00, 0x03, 0xe0, 0x3f, 0x80, 0x00, 0x00, 0x03, 0xe0, 0x3e, 0x00, 0x00, 0x00, 0x07, 0xe0, 0x3e, 0x00, 0x00, 0x00, 0x1f, 0xe0, 0x3e, 0x00, 0x00, 0x00, 0x1f, 0xe0, 0x3c, 0x00, 0x00, 0x00, 0x1f, 0xf0, 0x7c, 0x00, 0x00, 0x00, 0x01, 0xff, 0xfe, 0x00, 0x00, 0x00, 0x00, 0xff, 0xfe, 0x00, 0x00, 0x00, 0x00, 0x7f, 0xff, 0x00, 0x00, 0x00, 0x00, 0x3f, 0xff, 0x00, 0x00, 0x00, 0x00, 0x3f, 0x0f, 0x00, 0x00, 0x00, 0x00, 0x3c, 0x06, 0x00, 0x00, 0x00, 0x00, 0x3c, 0x00, 0x00, 0x00, 0x00, 0x00, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, };
-const uint8_t bmp_gears2_data[] = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x07, 0x00, 0x00, 0x00, 0x00, 0x00, 0x07, 0x80, 0x00, 0x00, 0x00, 0x00, 0x07, 0x80, 0x00, 0x00, 0x00, 0x00, 0x07, 0x80, 0x00, 0x00, 0x00, 0x00, 0x0f, 0xc1, 0x80, 0x00, 0x00, 0x07, 0x3f, 0xf7, 0xc0, 0x00, 0x00, 0x0f, 0xff, 0xff, 0xc0, 0x00, 0x00, 0x0f, 0xff, 0xff, 0x80, 0x00, 0x00, 0x07, 0xff, 0xff, 0x00, 0x00, 0x00, 0x03, 0xf8, 0x3e, 0x00, 0x00, 0x00, 0x01, 0xf0, 0x1e, 0x00, 0x00, 0x00, 0x01, 0xf0, 0x1e, 0x00, 0x00, 0x00, 0x01, 0xf0, 0x1e, 0x00, 0x00, 0x00, 0x01, 0xf0, 0x1e, 0x00, 0x00, 0x00, 0x03, 0xf0, 0x1e, 0x00, 0x00, 0x00, 0x03, 0xf8, 0x3f, 0x0e, 0x00, 0x00, 0x07, 0xff, 0xff, 0x8f, 0x00, 0x00, 0x0f, 0xff, 0xff, 0xcf, 0x00, 0x00, 0x0f, 0xff, 0xff, 0xcf, 0x00, 0x00, 0x06, 0x1f, 0xe1, 0x9f, 0x83, 0x00, 0x00, 0x0f, 0xce, 0x7f, 0xef, 0x80, 0x00, 0x07, 0x9f, 0xff, 0xff, 0x80, 0x00, 0x07, 0x9f, 0xff, 0xff, 0x00, 0x00, 0x03, 0x8f, 0xff, 0xfe, 0x00, 0x00, 0x00, 0x07, 0xf0, 0x7c, 0x00, 0x00, 0x00, 0x03, 0xe0, 0x3c, 0x00, 0x00, 0x00, 0x03, 0xe0, 0x3c, 0x00, 0x00, 0x00, 0x03, 0xe0, 0x3c, 0x00, 0x00, 0x00, 0x03, 0xe0, 0x3c, 0x00, 0x00, 0x00, 0x07, 0xe0, 0x3c, 0x00, 0x00, 0x00, 0x07, 0xf0, 0x7e, 0x00, 0x00, 0x00, 0x0f, 0xff, 0xff, 0x00, 0x00, 0x00, 0x1f, 0xff, 0xff, 0x80, 0x00, 0x00, 0x1f, 0xff, 0xff, 0x80, 0x00, 0x00, 0x0c, 0x3f, 0xc7, 0x00, 0x00, 0x00, 0x00, 0x1f, 0x80, 0x00, 0x00, 0x00, 0x00, 0x0f, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0f, 0x00, 0x00, 0x00, 0x00, 0x00, 0x07, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, };
-const uint8_t bmp_gears3_data[] = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xe0, 0x00, 0x00, 0x00, 0x00, 0x00, 0xe0, 0x00, 0x00, 0x00, 0x01, 0x81, 0xe0, 0x00, 0x00, 0x00, 0x03, 0xe1, 0xe0, 0x00, 0x00, 0x00, 0x03, 0xff, 0xe0, 0x00, 0x00, 0x00, 0x03, 0xff, 0xf0, 0x00, 0x00, 0x00, 0x01, 0xff, 0xf8, 0x00, 0x00, 0x00, 0x00, 0xff, 0xff, 0xc0, 0x00, 0x00, 0x00, 0xff, 0xff, 0xe0, 0x00, 0x00, 0x00, 0xf8, 0x3f, 0xe0, 0x00, 0x00, 0x01, 0xf0, 0x1f, 0xc0, 0x00, 0x00, 0x01, 0xf0, 0x1f, 0x00, 0x00, 0x00, 0x03, 0xf0, 0x1f, 0x00, 0x00, 0x00, 0x0f, 0xf0, 0x1f, 0x00, 0x00, 0x00, 0x0f, 0xf0, 0x1e, 0x00, 0x00, 0x00, 0x0f, 0xf8, 0x3e, 0x70, 0x00, 0x00, 0x00, 0xff, 0xff, 0x78, 0x00, 0x00, 0x00, 0x7f, 0xff, 0x78, 0x00, 0x00, 0x00, 0x3f, 0xff, 0x7c, 0x0e, 0x00, 0x00, 0x1f, 0xff, 0x7f, 0x9f, 0x00, 0x00, 0x1f, 0x87, 0x7f, 0xff, 0x00, 0x00, 0x1e, 0x00, 0xff, 0xfe, 0x00, 0x00, 0x1e, 0x01, 0xff, 0xfc, 0x00, 0x00, 0x0c, 0x1f, 0xff, 0xfc, 0x00, 0x00, 0x00, 0x3f, 0xf0, 0x7c, 0x00, 0x00, 0x00, 0x3f, 0xe0, 0x3c, 0x00, 0x00, 0x00, 0x3f, 0xe0, 0x3e, 0x00, 0x00, 0x00, 0x0f, 0xe0, 0x3f, 0x00, 0x00, 0x00, 0x03, 0xe0, 0x3f, 0xc0, 0x00, 0x00, 0x03, 0xe0, 0x3f, 0xc0, 0x00, 0x00, 0x03, 0xf0, 0x7f, 0xc0, 0x00, 0x00, 0x01, 0xff, 0xff, 0x80, 0x00, 0x00, 0x01, 0xff, 0xf8, 0x00, 0x00, 0x00, 0x03, 0xff, 0xf0, 0x00, 0x00, 0x00, 0x07, 0xff, 0xe0, 0x00, 0x00, 0x00, 0x07, 0x8f, 0xe0, 0x00, 0x00, 0x00, 0x03, 0x03, 0xe0, 0x00, 0x00, 0x00, 0x00, 0x01, 0xe0, 0x00, 0x00, 0x00, 0x00, 0x01, 0xc0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, };
+const uint8_t bmp_digit0_data[] = { 0x82, 0xff, 0x09, 0xe0, 0xc0, 0x80, 0x80, 0x9f, 0x9f, 0x80, 0x80, 0xc0, 0xe0, 0x85, 0xff, 0x09, 0x07, 0x03, 0x01, 0x01, 0xf9, 0xf9, 0x01, 0x01, 0x03, 0x07, 0x82, 0xff, };
+const uint8_t bmp_digit1_data[] = { 0x83, 0xff, 0x01, 0xe7, 0xc7, 0x83, 0x80, 0x8b, 0xff, 0x83, 0x01, 0x85, 0xff, };
+const uint8_t bmp_digit2_data[] = { 0x82, 0xff, 0x01, 0x9f, 0x9f, 0x83, 0x9e, 0x03, 0x80, 0x80, 0xc0, 0xe1, 0x85, 0xff, 0x00, 0x81, 0x82, 0x01, 0x83, 0x79, 0x01, 0xf9, 0xf9, 0x82, 0xff, };
+const uint8_t bmp_digit3_data[] = { 0x82, 0xff, 0x01, 0x9f, 0x9f, 0x83, 0x9e, 0x03, 0x80, 0x80, 0xc0, 0xe1, 0x85, 0xff, 0x01, 0xf9, 0xf9, 0x83, 0x79, 0x03, 0x01, 0x01, 0x03, 0x87, 0x82, 0xff, };
+const uint8_t bmp_digit4_data[] = { 0x07, 0xff, 0xff, 0xfe, 0xfc, 0xf8, 0xf1, 0xe3, 0xc7, 0x83, 0x80, 0x85, 0xff, 0x01, 0x1f, 0x1f, 0x83, 0x9f, 0x83, 0x01, 0x83, 0xff, };
+const uint8_t bmp_digit5_data[] = { 0x82, 0xff, 0x01, 0x81, 0x81, 0x83, 0x99, 0x03, 0x98, 0x98, 0xfc, 0xfe, 0x85, 0xff, 0x85, 0xf9, 0x03, 0x01, 0x01, 0x03, 0x07, 0x82, 0xff, };
+const uint8_t bmp_digit6_data[] = { 0x82, 0xff, 0x09, 0xe0, 0xc0, 0x80, 0x80, 0x99, 0x99, 0x98, 0x98, 0xfc, 0xfe, 0x85, 0xff, 0x09, 0x07, 0x03, 0x01, 0x01, 0xf9, 0xf9, 0x01, 0x01, 0x03, 0x07, 0x82, 0xff, };
+const uint8_t bmp_digit7_data[] = { 0x82, 0xff, 0x82, 0x9f, 0x06, 0x9e, 0x9c, 0x98, 0x80, 0x80, 0x83, 0x87, 0x87, 0xff, 0x00, 0x81, 0x82, 0x01, 0x00, 0x7f, 0x85, 0xff, };
+const uint8_t bmp_digit8_data[] = { 0x82, 0xff, 0x09, 0xe1, 0xc0, 0x80, 0x80, 0x9e, 0x9e, 0x80, 0x80, 0xc0, 0xe1, 0x85, 0xff, 0x09, 0x87, 0x03, 0x01, 0x01, 0x79, 0x79, 0x01, 0x01, 0x03, 0x87, 0x82, 0xff, };
+const uint8_t bmp_digit9_data[] = { 0x82, 0xff, 0x09, 0xe0, 0xc0, 0x80, 0x80, 0x9f, 0x9f, 0x80, 0x80, 0xc0, 0xe0, 0x85, 0xff, 0x09, 0x7f, 0x3f, 0x19, 0x19, 0x99, 0x99, 0x01, 0x01, 0x03, 0x07, 0x82, 0xff, };
+const uint8_t bmp_gears0_data[] = { 0x87, 0x00, 0x01, 0x01, 0x01, 0x89, 0x00, 0x01, 0x01, 0x01, 0xa0, 0x00, 0x05, 0xc1, 0xf7, 0xff, 0xff, 0x7f, 0x3f, 0x84, 0x3e, 0x04, 0x7f, 0xff, 0xff, 0xf7, 0xc1, 0x9b, 0x00, 0x83, 0x70, 0x01, 0xf8, 0xfe, 0x82, 0xff, 0x00, 0x07, 0x84, 0x03, 0x00, 0x07, 0x82, 0xff, 0x04, 0xfc, 0xf9, 0xf3, 0xf3, 0xe1, 0x86, 0x00, 0x03, 0x01, 0x03, 0x03, 0x01, 0x91, 0x00, 0x04, 0x70, 0xf8, 0xf8, 0xf0, 0xe0, 0x83, 0xc0, 0x06, 0xe0, 0xe0, 0xf0, 0xf8, 0xf8, 0x33, 0xcf, 0x82, 0xff, 0x00, 0x7e, 0x84, 0x7c, 0x05, 0xfe, 0xff, 0xff, 0xef, 0x87, 0x01, 0x9a, 0x00, 0x82, 0xe0, 0x02, 0xf0, 0xf0, 0xfc, 0x82, 0xff, 0x00, 0x0f, 0x84, 0x07, 0x00, 0x0f, 0x82, 0xff, 0x01, 0xf8, 0xf0, 0x82, 0xe0, 0x9c, 0x00, 0x04, 0x60, 0xf0, 0xf0, 0xe0, 0xc0, 0x84, 0x80, 0x04, 0xc0, 0xe0, 0xf0, 0xf0, 0x60, 0x89, 0x00, };
+const uint8_t bmp_gears1_data[] = { 0x89, 0x00, 0x82, 0x03, 0x00, 0x01, 0xa4, 0x00, 0x00, 0x01, 0x83, 0x03, 0x01, 0x07, 0x0f, 0x82, 0xff, 0x01, 0xfe, 0x7e, 0x82, 0x3e, 0x06, 0x1f, 0x1f, 0x3f, 0x7f, 0x7f, 0x78, 0x30, 0x99, 0x00, 0x04, 0xc0, 0xc0, 0xe0, 0xe0, 0xfc, 0x83, 0xff, 0x00, 0x07, 0x84, 0x03, 0x08, 0x07, 0xff, 0xff, 0xfe, 0xfd, 0x7d, 0x3e, 0x1e, 0x1c, 0x82, 0x00, 0x00, 0x01, 0x82, 0x07, 0x93, 0x00, 0x03, 0x60, 0xf0, 0xf0, 0xe0, 0x82, 0xc0, 0x02, 0xe0, 0xe0, 0xf0, 0x82, 0xfc, 0x03, 0xf8, 0x00, 0xe0, 0xf1, 0x82, 0xff, 0x03, 0x7f, 0x7e, 0x7c, 0x7c, 0x82, 0xfc, 0x02, 0xfe, 0x3f, 0x1f, 0x84, 0x0f, 0x00, 0x06, 0x98, 0x00, 0x08, 0x38, 0x38, 0x78, 0xf8, 0xfc, 0xfe, 0xff, 0xff, 0x0f, 0x84, 0x07, 0x00, 0x0f, 0x83, 0xff, 0x01, 0xe7, 0x01, 0xa1, 0x00, 0x05, 0xf0, 0xf8, 0xf8, 0xf0, 0xc0, 0xc0, 0x83, 0x80, 0x03, 0xc0, 0xe0, 0xe0, 0xc0, 0x87, 0x00, };
+const uint8_t bmp_gears2_data[] = { 0x8c, 0x00, 0x82, 0x03, 0x00, 0x01, 0xa2, 0x00, 0x08, 0x0c, 0x1e, 0x1f, 0x1f, 0x0f, 0x0f, 0x1f, 0x1f, 0x3f, 0x83, 0xfe, 0x08, 0x3e, 0x1f, 0x1f, 0x0f, 0x1f, 0x1f, 0x3e, 0x3c, 0x18, 0x99, 0x00, 0x02, 0x01, 0x03, 0x0f, 0x84, 0xff, 0x00, 0x07, 0x84, 0x03, 0x00, 0x07, 0x83, 0xff, 0x04, 0x07, 0x03, 0x01, 0x00, 0x00, 0x82, 0x07, 0x00, 0x03, 0x93, 0x00, 0x02, 0x80, 0xc0, 0xc0, 0x83, 0x80, 0x02, 0xc0, 0xe0, 0xf8, 0x82, 0xfc, 0x0a, 0xe0, 0xc0, 0x98, 0xbc, 0xbe, 0xbf, 0xdf, 0xdf, 0xbf, 0x3f, 0x7e, 0x83, 0xfc, 0x08, 0x7c, 0x3e, 0x3f, 0x1f, 0x3f, 0x3f, 0x7c, 0x78, 0x30, 0x99, 0x00, 0x02, 0x03, 0x07, 0x1f, 0x84, 0xff, 0x00, 0x0f, 0x84, 0x07, 0x00, 0x0f, 0x83, 0xff, 0x02, 0x0f, 0x07, 0x03, 0x9a, 0x00, 0x01, 0x80, 0x80, 0x83, 0x00, 0x02, 0x80, 0xc0, 0xf0, 0x82, 0xf8, 0x01, 0xc0, 0x80, 0x82, 0x00, 0x82, 0x80, 0x87, 0x00, };
+const uint8_t bmp_gears3_data[] = { 0x8f, 0x00, 0x82, 0x03, 0xa2, 0x00, 0x08, 0x70, 0xf8, 0xff, 0x7f, 0x7f, 0x3f, 0x3f, 0x3e, 0x3e, 0x82, 0xfe, 0x02, 0xff, 0x1f, 0x0f, 0x84, 0x07, 0x00, 0x03, 0x98, 0x00, 0x04, 0x1c, 0x1c, 0x3c, 0xfc, 0xfe, 0x82, 0xff, 0x00, 0x07, 0x84, 0x03, 0x00, 0x07, 0x83, 0xff, 0x05, 0xf3, 0x80, 0x87, 0x07, 0x07, 0x03, 0x9c, 0x00, 0x13, 0x80, 0xf8, 0xfc, 0xfc, 0xf8, 0xe0, 0xe0, 0xc0, 0xc3, 0xc7, 0xc7, 0xe7, 0xe7, 0xef, 0x1f, 0xff, 0xff, 0xfe, 0xfc, 0xfc, 0x82, 0x7c, 0x06, 0x3e, 0x3f, 0x7f, 0xff, 0xff, 0xf0, 0x60, 0x99, 0x00, 0x04, 0x80, 0x80, 0xc0, 0xc0, 0xf9, 0x83, 0xff, 0x00, 0x0f, 0x84, 0x07, 0x08, 0x0f, 0xff, 0xff, 0xfe, 0xfc, 0xfc, 0x7c, 0x3c, 0x38, 0x9a, 0x00, 0x03, 0xc0, 0xe0, 0xe0, 0xc0, 0x82, 0x80, 0x02, 0xc0, 0xc0, 0xe0, 0x82, 0xf8, 0x00, 0xf0, 0x8c, 0x00, };
 const uint8_t bmp_icon_error_data[] = { 0x07, 0xe0, 0x0f, 0xf0, 0x1f, 0xf8, 0x3f, 0xfc, 0x7b, 0xde, 0xf1, 0x8f, 0xf8, 0x1f, 0xfc, 0x3f, 0xfc, 0x3f, 0xf8, 0x1f, 0xf1, 0x8f, 0x7b, 0xde, 0x3f, 0xfc, 0x1f, 0xf8, 0x0f, 0xf0, 0x07, 0xe0, };
 const uint8_t bmp_icon_info_data[] = { 0x07, 0xe0, 0x0f, 0xf0, 0x1f, 0xf8, 0x3e, 0x7c, 0x7e, 0x7e, 0xff, 0xff, 0xfe, 0x7f, 0xfe, 0x7f, 0xfe, 0x7f, 0xfe, 0x7f, 0xfe, 0x7f, 0x7e, 0x7e, 0x3e, 0x7c, 0x1f, 0xf8, 0x0f, 0xf0, 0x07, 0xe0, };
 const uint8_t bmp_icon_ok_data[] = { 0x07, 0xe0, 0x0f, 0xf0, 0x1f, 0xf8, 0x3f, 0xfc, 0x7f, 0xfe, 0xff, 0xef, 0xff, 0xdf, 0xff, 0xbf, 0xf9, 0x3f, 0xf8, 0x7f, 0xfc, 0xff, 0x7e, 0xfe, 0x3f, 0xfc, 0x1f, 0xf8, 0x0f, 0xf0, 0x07, 0xe0, };
 const uint8_t bmp_icon_question_data[] = { 0x07, 0xe0, 0x0f, 0xf0, 0x1e, 0x78, 0x3c, 0x3c, 0x79, 0x9e, 0xf3, 0xcf, 0xff, 0xcf, 0xff, 0x9f, 0xff, 0x3f, 0xfe, 0x7f, 0xfe, 0x7f, 0x7f, 0xfe, 0x3e, 0x7c, 0x1e, 0x78, 0x0f, 0xf0, 0x07, 0xe0, };
-const uint8_t bmp_icon_warning_data[] = { 0x01, 0x80, 0x01, 0x80, 0x03, 0xc0, 0x03, 0xc0, 0x07, 0xe0, 0x07, 0xe0, 0x0e, 0x70, 0x0e, 0x70, 0x1e, 0x78, 0x1e, 0x78, 0x3e, 0x7c, 0x3f, 0xfc, 0x7e, 0x7e, 0x7e, 0x7e, 0xff, 0xff, 0xff, 0xff, };
-const uint8_t bmp_logo48_data[] = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x7e, 0x00, 0x00, 0x00, 0x01, 0xff, 0x80, 0x00, 0x00, 0x07, 0xff, 0xe0, 0x00, 0x00, 0x0f, 0xff, 0xf0, 0x00, 0x00, 0x1f, 0xff, 0xf8, 0x00, 0x00, 0x3f, 0x81, 0xfc, 0x00, 0x00, 0x3e, 0x00, 0x7c, 0x00, 0x00, 0x7c, 0x00, 0x3e, 0x00, 0x00, 0x78, 0x00, 0x1e, 0x00, 0x00, 0xf8, 0x00, 0x1f, 0x00, 0x00, 0xf0, 0x00, 0x0f, 0x00, 0x00, 0xf0, 0x00, 0x0f, 0x00, 0x00, 0xf0, 0x00, 0x0f, 0x00, 0x00, 0xf0, 0x00, 0x0f, 0x00, 0x00, 0xf0, 0x00, 0x0f, 0x00, 0x00, 0xf0, 0x00, 0x0f, 0x00, 0x03, 0xff, 0xff, 0xff, 0xc0, 0x0f, 0xff, 0xff, 0xff, 0xf0, 0x0f, 0xff, 0xff, 0xff, 0xf0, 0x0f, 0xff, 0xff, 0xff, 0xf0, 0x0f, 0xff, 0xff, 0xff, 0xf0, 0x0f, 0xc0, 0x00, 0x03, 0xf0, 0x0f, 0x80, 0x00, 0x01, 0xf0, 0x0f, 0x80, 0x00, 0x01, 0xf0, 0x0f, 0x80, 0x00, 0x01, 0xf0, 0x0f, 0x80, 0x00, 0x01, 0xf0, 0x0f, 0x80, 0x00, 0x01, 0xf0, 0x0f, 0x80, 0x00, 0x01, 0xf0, 0x0f, 0x80, 0x00, 0x01, 0xf0, 0x0f, 0x80, 0x00, 0x01, 0xf0, 0x0f, 0x80, 0x00, 0x01, 0xf0, 0x0f, 0x80, 0x00, 0x01, 0xf0, 0x0f, 0x80, 0x00, 0x01, 0xf0, 0x0f, 0x80, 0x00, 0x01, 0xf0, 0x0f, 0x80, 0x00, 0x01, 0xf0, 0x0f, 0x80, 0x00, 0x01, 0xf0, 0x0f, 0x80, 0x00, 0x01, 0xf0, 0x0f, 0x80, 0x00, 0x01, 0xf0, 0x0f, 0xe0, 0x00, 0x07, 0xf0, 0x0f, 0xfc, 0x00, 0x3f, 0xf0, 0x0f, 0xff, 0x81, 0xff, 0xf0, 0x07, 0xff, 0xff, 0xff, 0xe0, 0x00, 0xff, 0xff, 0xff, 0x00, 0x00, 0x1f, 0xff, 0xf8, 0x00, 0x00, 0x03, 0xff, 0xc0, 0x00, 0x00, 0x00, 0x7e, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, };
-const uint8_t bmp_logo48_empty_data[] = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x7e, 0x00, 0x00, 0x00, 0x01, 0x81, 0x80, 0x00, 0x00, 0x06, 0x00, 0x60, 0x00, 0x00, 0x08, 0x00, 0x10, 0x00, 0x00, 0x10, 0x7e, 0x08, 0x00, 0x00, 0x21, 0x81, 0x84, 0x00, 0x00, 0x22, 0x00, 0x44, 0x00, 0x00, 0x44, 0x00, 0x22, 0x00, 0x00, 0x48, 0x00, 0x12, 0x00, 0x00, 0x88, 0x00, 0x11, 0x00, 0x00, 0x90, 0x00, 0x09, 0x00, 0x00, 0x90, 0x00, 0x09, 0x00, 0x00, 0x90, 0x00, 0x09, 0x00, 0x00, 0x90, 0x00, 0x09, 0x00, 0x00, 0x90, 0x00, 0x09, 0x00, 0x00, 0x90, 0x00, 0x09, 0x00, 0x03, 0x9f, 0xff, 0xf9, 0xc0, 0x04, 0x00, 0x00, 0x00, 0x20, 0x08, 0x00, 0x00, 0x00, 0x10, 0x08, 0x00, 0x00, 0x00, 0x10, 0x08, 0x3f, 0xff, 0xfc, 0x10, 0x08, 0x40, 0x00, 0x02, 0x10, 0x08, 0x80, 0x00, 0x01, 0x10, 0x08, 0x80, 0x00, 0x01, 0x10, 0x08, 0x80, 0x00, 0x01, 0x10, 0x08, 0x80, 0x00, 0x01, 0x10, 0x08, 0x80, 0x00, 0x01, 0x10, 0x08, 0x80, 0x00, 0x01, 0x10, 0x08, 0x80, 0x00, 0x01, 0x10, 0x08, 0x80, 0x00, 0x01, 0x10, 0x08, 0x80, 0x00, 0x01, 0x10, 0x08, 0x80, 0x00, 0x01, 0x10, 0x08, 0x80, 0x00, 0x01, 0x10, 0x08, 0x80, 0x00, 0x01, 0x10, 0x08, 0x80, 0x00, 0x01, 0x10, 0x08, 0x80, 0x00, 0x01, 0x10, 0x08, 0x80, 0x00, 0x01, 0x10, 0x08, 0x80, 0x00, 0x01, 0x10, 0x08, 0x60, 0x00, 0x06, 0x10, 0x08, 0x1c, 0x00, 0x38, 0x10, 0x08, 0x03, 0x81, 0xc0, 0x10, 0x07, 0x00, 0x7e, 0x00, 0xe0, 0x00, 0xe0, 0x00, 0x07, 0x00, 0x00, 0x1c, 0x00, 0x38, 0x00, 0x00, 0x03, 0x81, 0xc0, 0x00, 0x00, 0x00, 0x7e, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, };
-const uint8_t bmp_logo64_data[] = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0f, 0xe0, 0x00, 0x00, 0x00, 0x00, 0x7f, 0xfc, 0x00, 0x00, 0x00, 0x01, 0xff, 0xff, 0x00, 0x00, 0x00, 0x03, 0xff, 0xff, 0x80, 0x00, 0x00, 0x07, 0xff, 0xff, 0xc0, 0x00, 0x00, 0x0f, 0xff, 0xff, 0xe0, 0x00, 0x00, 0x1f, 0xff, 0xff, 0xf0, 0x00, 0x00, 0x3f, 0xf0, 0x1f, 0xf8, 0x00, 0x00, 0x3f, 0xc0, 0x07, 0xf8, 0x00, 0x00, 0x7f, 0x80, 0x03, 0xfc, 0x00, 0x00, 0x7f, 0x00, 0x01, 0xfc, 0x00, 0x00, 0x7e, 0x00, 0x00, 0xfc, 0x00, 0x00, 0xfe, 0x00, 0x00, 0xfe, 0x00, 0x00, 0xfe, 0x00, 0x00, 0xfe, 0x00, 0x00, 0xfc, 0x00, 0x00, 0x7e, 0x00, 0x00, 0xfc, 0x00, 0x00, 0x7e, 0x00, 0x00, 0xfc, 0x00, 0x00, 0x7e, 0x00, 0x00, 0xfc, 0x00, 0x00, 0x7e, 0x00, 0x00, 0xfc, 0x00, 0x00, 0x7e, 0x00, 0x00, 0xfc, 0x00, 0x00, 0x7e, 0x00, 0x00, 0xfc, 0x00, 0x00, 0x7e, 0x00, 0x00, 0xff, 0xff, 0xff, 0xfe, 0x00, 0x07, 0xff, 0xff, 0xff, 0xff, 0xc0, 0x1f, 0xff, 0xff, 0xff, 0xff, 0xf0, 0x1f, 0xff, 0xff, 0xff, 0xff, 0xf0, 0x1f, 0xff, 0xff, 0xff, 0xff, 0xf0, 0x1f, 0xff, 0xff, 0xff, 0xff, 0xf0, 0x1f, 0xff, 0xff, 0xff, 0xff, 0xf0, 0x1f, 0xff, 0x80, 0x03, 0xff, 0xf0, 0x1f, 0xc0, 0x00, 0x00, 0x07, 0xf0, 0x1f, 0x80, 0x00, 0x00, 0x03, 0xf0, 0x1f, 0x80, 0x00, 0x00, 0x03, 0xf0, 0x1f, 0x80, 0x00, 0x00, 0x03, 0xf0, 0x1f, 0x80, 0x00, 0x00, 0x03, 0xf0, 0x1f, 0x80, 0x00, 0x00, 0x03, 0xf0, 0x1f, 0x80, 0x00, 0x00, 0x03, 0xf0, 0x1f, 0x80, 0x00, 0x00, 0x03, 0xf0, 0x1f, 0x80, 0x00, 0x00, 0x03, 0xf0, 0x1f, 0x80, 0x00, 0x00, 0x03, 0xf0, 0x1f, 0x80, 0x00, 0x00, 0x03, 0xf0, 0x1f, 0x80, 0x00, 0x00, 0x03, 0xf0, 0x1f, 0x80, 0x00, 0x00, 0x03, 0xf0, 0x1f, 0x80, 0x00, 0x00, 0x03, 0xf0, 0x1f, 0x80, 0x00, 0x00, 0x03, 0xf0, 0x1f, 0x80, 0x00, 0x00, 0x03, 0xf0, 0x1f, 0x80, 0x00, 0x00, 0x03, 0xf0, 0x1f, 0x80, 0x00, 0x00, 0x03, 0xf0, 0x1f, 0x80, 0x00, 0x00, 0x03, 0xf0, 0x1f, 0x80, 0x00, 0x00, 0x03, 0xf0, 0x1f, 0x80, 0x00, 0x00, 0x03, 0xf0, 0x1f, 0xe0, 0x00, 0x00, 0x0f, 0xf0, 0x1f, 0xfc, 0x00, 0x00, 0x7f, 0xf0, 0x1f, 0xff, 0x00, 0x01, 0xff, 0xf0, 0x1f, 0xff, 0xf0, 0x1f, 0xff, 0xf0, 0x1f, 0xff, 0xfc, 0x7f, 0xff, 0xf0, 0x0f, 0xff, 0xff, 0xff, 0xff, 0xe0, 0x01, 0xff, 0xff, 0xff, 0xff, 0x00, 0x00, 0x3f, 0xff, 0xff, 0xf8, 0x00, 0x00, 0x0f, 0xff, 0xff, 0xe0, 0x00, 0x00, 0x01, 0xff, 0xff, 0x00, 0x00, 0x00, 0x00, 0x3f, 0xf8, 0x00, 0x00, 0x00, 0x00, 0x07, 0xc0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, };
-const uint8_t bmp_logo64_empty_data[] = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0f, 0xe0, 0x00, 0x00, 0x00, 0x00, 0x70, 0x1c, 0x00, 0x00, 0x00, 0x01, 0x80, 0x03, 0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x80, 0x00, 0x00, 0x04, 0x00, 0x00, 0x40, 0x00, 0x00, 0x08, 0x00, 0x00, 0x20, 0x00, 0x00, 0x10, 0x0f, 0xe0, 0x10, 0x00, 0x00, 0x20, 0x30, 0x18, 0x08, 0x00, 0x00, 0x20, 0x40, 0x04, 0x08, 0x00, 0x00, 0x40, 0x80, 0x02, 0x04, 0x00, 0x00, 0x41, 0x00, 0x01, 0x04, 0x00, 0x00, 0x42, 0x00, 0x00, 0x84, 0x00, 0x00, 0x82, 0x00, 0x00, 0x82, 0x00, 0x00, 0x82, 0x00, 0x00, 0x82, 0x00, 0x00, 0x84, 0x00, 0x00, 0x42, 0x00, 0x00, 0x84, 0x00, 0x00, 0x42, 0x00, 0x00, 0x84, 0x00, 0x00, 0x42, 0x00, 0x00, 0x84, 0x00, 0x00, 0x42, 0x00, 0x00, 0x84, 0x00, 0x00, 0x42, 0x00, 0x00, 0x84, 0x00, 0x00, 0x42, 0x00, 0x00, 0x84, 0x00, 0x00, 0x42, 0x00, 0x00, 0x87, 0xff, 0xff, 0xc2, 0x00, 0x03, 0x80, 0x00, 0x00, 0x03, 0x80, 0x1c, 0x00, 0x00, 0x00, 0x00, 0x70, 0x10, 0x00, 0x00, 0x00, 0x00, 0x10, 0x10, 0x00, 0x00, 0x00, 0x00, 0x10, 0x10, 0x00, 0x00, 0x00, 0x00, 0x10, 0x10, 0x00, 0x7f, 0xfc, 0x00, 0x10, 0x10, 0x3f, 0x80, 0x03, 0xf8, 0x10, 0x10, 0x40, 0x00, 0x00, 0x04, 0x10, 0x10, 0x80, 0x00, 0x00, 0x02, 0x10, 0x10, 0x80, 0x00, 0x00, 0x02, 0x10, 0x10, 0x80, 0x00, 0x00, 0x02, 0x10, 0x10, 0x80, 0x00, 0x00, 0x02, 0x10, 0x10, 0x80, 0x00, 0x00, 0x02, 0x10, 0x10, 0x80, 0x00, 0x00, 0x02, 0x10, 0x10, 0x80, 0x00, 0x00, 0x02, 0x10, 0x10, 0x80, 0x00, 0x00, 0x02, 0x10, 0x10, 0x80, 0x00, 0x00, 0x02, 0x10, 0x10, 0x80, 0x00, 0x00, 0x02, 0x10, 0x10, 0x80, 0x00, 0x00, 0x02, 0x10, 0x10, 0x80, 0x00, 0x00, 0x02, 0x10, 0x10, 0x80, 0x00, 0x00, 0x02, 0x10, 0x10, 0x80, 0x00, 0x00, 0x02, 0x10, 0x10, 0x80, 0x00, 0x00, 0x02, 0x10, 0x10, 0x80, 0x00, 0x00, 0x02, 0x10, 0x10, 0x80, 0x00, 0x00, 0x02, 0x10, 0x10, 0x80, 0x00, 0x00, 0x02, 0x10, 0x10, 0x80, 0x00, 0x00, 0x02, 0x10, 0x10, 0x80, 0x00, 0x00, 0x02, 0x10, 0x10, 0x60, 0x00, 0x00, 0x0c, 0x10, 0x10, 0x1c, 0x00, 0x00, 0x70, 0x10, 0x10, 0x03, 0x00, 0x01, 0x80, 0x10, 0x10, 0x00, 0xf0, 0x1e, 0x00, 0x10, 0x10, 0x00, 0x0c, 0x60, 0x00, 0x10, 0x0e, 0x00, 0x03, 0x80, 0x00, 0xe0, 0x01, 0xc0, 0x00, 0x00, 0x07, 0x00, 0x00, 0x30, 0x00, 0x00, 0x18, 0x00, 0x00, 0x0e, 0x00, 0x00, 0xe0, 0x00, 0x00, 0x01, 0xc0, 0x07, 0x00, 0x00, 0x00, 0x00, 0x38, 0x38, 0x00, 0x00, 0x00, 0x00, 0x07, 0xc0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, };
-const uint8_t bmp_u2f_bitbucket_data[] = { 0x00, 0x3f, 0xf8, 0x00, 0x07, 0xff, 0xff, 0xc0, 0x1f, 0xff, 0xff, 0xf0, 0x3f, 0x00, 0x01, 0xf8, 0x3c, 0x00, 0x00, 0x78, 0x3f, 0x00, 0x01, 0xf8, 0x3f, 0xff, 0xff, 0xf8, 0x3f, 0xff, 0xff, 0xf8, 0x3f, 0xff, 0xff, 0xf8, 0x3f, 0xff, 0xff, 0xf8, 0x3f, 0xff, 0xff, 0xf8, 0x3f, 0xf8, 0x3f, 0xf8, 0x1f, 0xf0, 0x1f, 0xf0, 0x1f, 0xe3, 0x8f, 0xf0, 0x1f, 0xe7, 0xcf, 0xf0, 0x1f, 0xe7, 0xcf, 0xf0, 0x1f, 0xe7, 0xcf, 0xf0, 0x0f, 0xe3, 0x8f, 0xe0, 0x0f, 0xf0, 0x1f, 0xe0, 0x0f, 0xf8, 0x3f, 0xe0, 0x07, 0xff, 0xff, 0xc0, 0x01, 0xff, 0xff, 0x00, 0x04, 0x3f, 0xf8, 0x40, 0x07, 0x00, 0x01, 0xc0, 0x07, 0xc0, 0x07, 0xc0, 0x07, 0xff, 0xff, 0xc0, 0x07, 0xff, 0xff, 0xc0, 0x03, 0xff, 0xff, 0x80, 0x03, 0xff, 0xff, 0x80, 0x01, 0xff, 0xff, 0x00, 0x00, 0xff, 0xfe, 0x00, 0x00, 0x0f, 0xe0, 0x00, };
-const uint8_t bmp_u2f_bitfinex_data[] = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0f, 0xe0, 0x00, 0x00, 0xff, 0xe0, 0x00, 0x03, 0xff, 0xa0, 0x00, 0x0f, 0xff, 0x20, 0x00, 0x3f, 0xff, 0x60, 0x00, 0x7f, 0xfe, 0xe0, 0x00, 0xff, 0xfc, 0xe0, 0x01, 0xff, 0xf1, 0xe0, 0x01, 0xff, 0xe3, 0xe0, 0x03, 0xff, 0xc7, 0xe0, 0x03, 0xff, 0x8f, 0xc0, 0x07, 0xfe, 0x0f, 0xc0, 0x07, 0xfc, 0x1f, 0xc0, 0x07, 0xf0, 0x7f, 0x80, 0x07, 0x80, 0xff, 0x80, 0x00, 0x01, 0xff, 0x00, 0x00, 0x07, 0xff, 0x00, 0x00, 0x1f, 0xfe, 0x00, 0x00, 0x7f, 0xfc, 0x00, 0x01, 0xff, 0xf8, 0x00, 0x00, 0xff, 0xe0, 0x00, 0x00, 0x1f, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, };
-const uint8_t bmp_u2f_dropbox_data[] = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x60, 0x03, 0x00, 0x01, 0xf0, 0x0f, 0x80, 0x07, 0xf8, 0x1f, 0xe0, 0x0f, 0xfc, 0x3f, 0xf8, 0x3f, 0xfe, 0x7f, 0xfc, 0x7f, 0xfe, 0x7f, 0xff, 0x7f, 0xfc, 0x1f, 0xfe, 0x3f, 0xf0, 0x0f, 0xfc, 0x1f, 0xe0, 0x03, 0xf8, 0x07, 0x80, 0x00, 0xe0, 0x03, 0x00, 0x00, 0x40, 0x03, 0x00, 0x00, 0x60, 0x07, 0x80, 0x01, 0xf0, 0x1f, 0xe0, 0x03, 0xf8, 0x3f, 0xf0, 0x0f, 0xfc, 0x7f, 0xfc, 0x3f, 0xfe, 0x7f, 0xfe, 0x7f, 0xfe, 0x1f, 0xfe, 0x7f, 0xfc, 0x0f, 0xfc, 0x3f, 0xf0, 0x03, 0xf9, 0x9f, 0xc0, 0x00, 0xe3, 0xc7, 0x80, 0x00, 0x47, 0xe2, 0x00, 0x03, 0x1f, 0xf8, 0x40, 0x03, 0xff, 0xfd, 0xc0, 0x01, 0xff, 0xff, 0x80, 0x00, 0x7f, 0xff, 0x00, 0x00, 0x3f, 0xfc, 0x00, 0x00, 0x0f, 0xf8, 0x00, 0x00, 0x07, 0xe0, 0x00, 0x00, 0x01, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, };
-const uint8_t bmp_u2f_fastmail_data[] = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x3f, 0xff, 0xff, 0xfc, 0x1f, 0xff, 0xff, 0xf8, 0x4f, 0xff, 0xff, 0xf2, 0x67, 0xff, 0xff, 0xe6, 0x73, 0xff, 0xff, 0xce, 0x79, 0xff, 0xff, 0x9e, 0x7c, 0xff, 0xff, 0x3e, 0x7e, 0x7f, 0xfe, 0x7e, 0x7f, 0x3f, 0xfc, 0xfe, 0x7f, 0x9f, 0xf9, 0xfe, 0x7f, 0xcf, 0xf3, 0xfe, 0x7f, 0xe7, 0xe7, 0xfe, 0x7f, 0xf3, 0xcf, 0xfe, 0x7f, 0xf8, 0x1f, 0xfe, 0x7f, 0xfc, 0x3f, 0xfe, 0x7f, 0xff, 0xff, 0xfe, 0x7f, 0xff, 0xff, 0xfe, 0x7f, 0xff, 0xff, 0xfe, 0x7f, 0xff, 0xff, 0xfe, 0x7f, 0xff, 0xff, 0xfe, 0x7f, 0xff, 0xff, 0xfe, 0x3f, 0xff, 0xff, 0xfc, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, };
-const uint8_t bmp_u2f_gandi_data[] = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x07, 0xc0, 0x00, 0x00, 0x0f, 0xe0, 0x00, 0x00, 0x1f, 0xf0, 0x00, 0x00, 0x1c, 0x70, 0x00, 0x00, 0x1c, 0x70, 0x00, 0x00, 0x1f, 0xf0, 0x00, 0x01, 0x8f, 0xe1, 0x00, 0x03, 0xc7, 0xc3, 0x80, 0x03, 0xe0, 0x07, 0x80, 0x01, 0xf0, 0x1f, 0x80, 0x01, 0xff, 0xff, 0x00, 0x00, 0xff, 0xfe, 0x00, 0x00, 0x3f, 0xfc, 0x00, 0x00, 0x0f, 0xf0, 0x00, 0x00, 0x1f, 0xc0, 0x00, 0x00, 0x3f, 0x80, 0x00, 0x00, 0x7e, 0x00, 0x00, 0x00, 0x7c, 0x00, 0x00, 0x00, 0xf8, 0x30, 0x00, 0x00, 0xf0, 0xfc, 0x00, 0x00, 0xf1, 0xfe, 0x00, 0x00, 0xf3, 0xff, 0x00, 0x00, 0xf1, 0xcf, 0x00, 0x00, 0xf0, 0x8f, 0x00, 0x00, 0xf0, 0x0f, 0x00, 0x00, 0x78, 0x1f, 0x00, 0x00, 0x7e, 0x7e, 0x00, 0x00, 0x3f, 0xfc, 0x00, 0x00, 0x1f, 0xf8, 0x00, 0x00, 0x0f, 0xf0, 0x00, 0x00, 0x00, 0x00, 0x00, };
-const uint8_t bmp_u2f_github_data[] = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1e, 0x00, 0x00, 0x78, 0x1f, 0x80, 0x01, 0xf8, 0x1f, 0xe0, 0x03, 0xf8, 0x1f, 0xff, 0xff, 0xf8, 0x1f, 0xff, 0xff, 0xf8, 0x1f, 0xff, 0xff, 0xf8, 0x1f, 0xff, 0xff, 0xf8, 0x3f, 0xff, 0xff, 0xfc, 0x3f, 0xff, 0xff, 0xfc, 0x7f, 0xff, 0xff, 0xfe, 0x7f, 0xff, 0xff, 0xfe, 0xff, 0xff, 0xff, 0xff, 0xff, 0x03, 0xc0, 0xff, 0xfc, 0x00, 0x00, 0x3f, 0xf8, 0x00, 0x00, 0x1f, 0xf8, 0x20, 0x04, 0x1f, 0xf0, 0x70, 0x0e, 0x0f, 0x70, 0xf0, 0x0f, 0x0e, 0x70, 0xf8, 0x1f, 0x0e, 0x70, 0x70, 0x0e, 0x0e, 0x30, 0x70, 0x0e, 0x0c, 0x38, 0x00, 0x00, 0x1c, 0x1c, 0x00, 0x00, 0x38, 0x0e, 0x00, 0x00, 0x70, 0x07, 0x80, 0x01, 0xe0, 0x01, 0xff, 0xff, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, };
-const uint8_t bmp_u2f_gitlab_data[] = { 0x00, 0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x20, 0x06, 0x00, 0x00, 0x60, 0x06, 0x00, 0x00, 0x60, 0x07, 0x00, 0x00, 0x70, 0x0f, 0x00, 0x00, 0xf0, 0x0f, 0x00, 0x00, 0xf0, 0x0f, 0x00, 0x00, 0xf8, 0x1f, 0x80, 0x01, 0xf8, 0x1f, 0x80, 0x01, 0xf8, 0x1f, 0x80, 0x01, 0xf8, 0x3f, 0xc0, 0x03, 0xfc, 0x3f, 0xc0, 0x03, 0xfc, 0x3f, 0xff, 0xff, 0xfc, 0x7f, 0xff, 0xff, 0xfe, 0x7f, 0xff, 0xff, 0xfe, 0x7f, 0xff, 0xff, 0xfe, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x7f, 0xff, 0xff, 0xff, 0x3f, 0xff, 0xff, 0xfc, 0x1f, 0xff, 0xff, 0xf8, 0x07, 0xff, 0xff, 0xe0, 0x03, 0xff, 0xff, 0xc0, 0x01, 0xff, 0xff, 0x80, 0x00, 0x7f, 0xfe, 0x00, 0x00, 0x3f, 0xfc, 0x00, 0x00, 0x1f, 0xf8, 0x00, 0x00, 0x07, 0xe0, 0x00, 0x00, 0x03, 0xc0, 0x00, 0x00, 0x01, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, };
-const uint8_t bmp_u2f_google_data[] = { 0x00, 0x0f, 0xf0, 0x00, 0x00, 0x7f, 0xfe, 0x00, 0x01, 0xff, 0xff, 0x80, 0x03, 0xff, 0xff, 0xc0, 0x07, 0xf0, 0x0f, 0xe0, 0x0f, 0xc0, 0x03, 0xf0, 0x1f, 0x00, 0x01, 0xf8, 0x3e, 0x00, 0x00, 0xfc, 0x3c, 0x00, 0x01, 0xfc, 0x7c, 0x0f, 0xf3, 0xfe, 0x78, 0x1f, 0xff, 0xfe, 0x78, 0x3f, 0xff, 0xfe, 0xf0, 0x3f, 0xff, 0xff, 0xf0, 0x7f, 0xff, 0xff, 0xf0, 0x7f, 0x00, 0x1f, 0xf0, 0x7f, 0x00, 0x1f, 0xf0, 0x7f, 0x00, 0x1f, 0xf0, 0x7f, 0x00, 0x1f, 0xf0, 0x7f, 0xfe, 0x1f, 0xf0, 0x3f, 0xfe, 0x1f, 0x78, 0x3f, 0xfc, 0x1e, 0x78, 0x1f, 0xf8, 0x3e, 0x7c, 0x07, 0xf0, 0x3e, 0x3c, 0x00, 0x00, 0x7c, 0x3e, 0x00, 0x00, 0xfc, 0x1f, 0x00, 0x00, 0xf8, 0x0f, 0xc0, 0x03, 0xf0, 0x07, 0xf0, 0x0f, 0xe0, 0x03, 0xff, 0xff, 0xc0, 0x01, 0xff, 0xff, 0x80, 0x00, 0x7f, 0xfe, 0x00, 0x00, 0x0f, 0xf0, 0x00, };
-const uint8_t bmp_u2f_slushpool_data[] = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xef, 0x00, 0x00, 0x00, 0xef, 0x00, 0x00, 0x01, 0xee, 0x00, 0x01, 0xff, 0xff, 0x00, 0x01, 0xff, 0xff, 0xc0, 0x01, 0xff, 0xff, 0xe0, 0x03, 0xff, 0xff, 0xf0, 0x03, 0xff, 0xff, 0xf8, 0x00, 0xfe, 0x0f, 0xf8, 0x00, 0xfe, 0x03, 0xf8, 0x00, 0xfc, 0x03, 0xf8, 0x00, 0xfc, 0x03, 0xf8, 0x01, 0xfc, 0x03, 0xf8, 0x01, 0xfc, 0x03, 0xf0, 0x01, 0xfc, 0x07, 0xf0, 0x01, 0xfc, 0x1f, 0xf0, 0x0f, 0xff, 0xff, 0xe0, 0x0f, 0xff, 0xff, 0xe0, 0x0f, 0xff, 0xff, 0xc0, 0x0f, 0xff, 0xff, 0x00, 0x0f, 0xff, 0xfc, 0x00, 0x03, 0xf0, 0x00, 0x00, 0x07, 0xf0, 0x00, 0x00, 0x07, 0xf0, 0x00, 0x00, 0x07, 0xf0, 0x00, 0x00, 0x07, 0xe0, 0x00, 0x00, 0x07, 0xe0, 0x00, 0x00, 0x0f, 0xe0, 0x00, 0x00, 0x0f, 0xe0, 0x00, 0x00, 0x0f, 0xe0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, };
-const uint8_t bmp_u2f_yubico_data[] = { 0x00, 0x1f, 0xf8, 0x00, 0x00, 0x7f, 0xfe, 0x00, 0x01, 0xff, 0xff, 0x80, 0x03, 0xfc, 0x3f, 0xc0, 0x07, 0xe0, 0x07, 0xe0, 0x0f, 0x80, 0x01, 0xf0, 0x1f, 0x00, 0x00, 0x78, 0x3e, 0x00, 0x00, 0x3c, 0x3c, 0x7c, 0x1f, 0x3c, 0x78, 0x7c, 0x1f, 0x1e, 0x78, 0x7c, 0x3e, 0x0e, 0xf0, 0x3e, 0x3e, 0x0f, 0xf0, 0x3e, 0x3c, 0x0f, 0xf0, 0x1f, 0x7c, 0x0f, 0xe0, 0x1f, 0x7c, 0x07, 0xe0, 0x1f, 0x78, 0x07, 0xe0, 0x0f, 0xf8, 0x07, 0xe0, 0x0f, 0xf0, 0x07, 0xf0, 0x0f, 0xf0, 0x0f, 0xf0, 0x07, 0xf0, 0x0f, 0xf0, 0x07, 0xe0, 0x0f, 0x78, 0x03, 0xe0, 0x0e, 0x78, 0x07, 0xc0, 0x1e, 0x3c, 0x07, 0xc0, 0x3e, 0x3c, 0x0f, 0xc0, 0x3c, 0x1e, 0x0f, 0x80, 0x78, 0x0f, 0x8f, 0x81, 0xf0, 0x07, 0xc0, 0x03, 0xe0, 0x03, 0xfc, 0x3f, 0xc0, 0x01, 0xff, 0xff, 0x80, 0x00, 0x7f, 0xff, 0x00, 0x00, 0x1f, 0xf8, 0x00, };
+const uint8_t bmp_icon_warning_data[] = { 0x83, 0x00, 0x07, 0x03, 0x0f, 0x3f, 0xfc, 0xfc, 0x3f, 0x0f, 0x03, 0x83, 0x00, 0x02, 0x03, 0x0f, 0x3f, 0x83, 0xff, 0x01, 0x13, 0x13, 0x83, 0xff, 0x02, 0x3f, 0x0f, 0x03, };
+const uint8_t bmp_logo48_data[] = { 0x89, 0x00, 0x06, 0x03, 0x07, 0x0f, 0x1f, 0x1f, 0x3e, 0x3e, 0x85, 0x7c, 0x06, 0x3e, 0x3e, 0x1f, 0x1f, 0x0f, 0x07, 0x03, 0x91, 0x00, 0x00, 0x3f, 0x82, 0xff, 0x01, 0xe0, 0x80, 0x8b, 0x00, 0x01, 0x80, 0xe0, 0x82, 0xff, 0x00, 0x3f, 0x8b, 0x00, 0x07, 0x3f, 0x3f, 0x7f, 0x7f, 0xff, 0xfe, 0xfc, 0xfc, 0x8f, 0x7c, 0x07, 0xfc, 0xfc, 0xfe, 0xff, 0x7f, 0x7f, 0x3f, 0x3f, 0x87, 0x00, 0x84, 0xff, 0x95, 0x00, 0x84, 0xff, 0x87, 0x00, 0x84, 0xff, 0x01, 0x01, 0x01, 0x91, 0x00, 0x01, 0x01, 0x01, 0x84, 0xff, 0x87, 0x00, 0x00, 0xc0, 0x82, 0xe0, 0x82, 0xf0, 0x82, 0xf8, 0x82, 0x7c, 0x85, 0x3e, 0x82, 0x7c, 0x82, 0xf8, 0x82, 0xf0, 0x82, 0xe0, 0x00, 0xc0, 0x83, 0x00, };
+const uint8_t bmp_logo48_empty_data[] = { 0x89, 0x00, 0x06, 0x03, 0x04, 0x08, 0x10, 0x11, 0x22, 0x22, 0x85, 0x44, 0x06, 0x22, 0x22, 0x11, 0x10, 0x08, 0x04, 0x03, 0x91, 0x00, 0x05, 0x3f, 0xc0, 0x00, 0x1f, 0x60, 0x80, 0x8b, 0x00, 0x05, 0x80, 0x60, 0x1f, 0x00, 0xc0, 0x3f, 0x8b, 0x00, 0x07, 0x1f, 0x20, 0x40, 0x40, 0xc1, 0x02, 0x04, 0xc4, 0x8f, 0x44, 0x07, 0xc4, 0x04, 0x02, 0xc1, 0x40, 0x40, 0x20, 0x1f, 0x87, 0x00, 0x00, 0xff, 0x82, 0x00, 0x00, 0xff, 0x95, 0x00, 0x00, 0xff, 0x82, 0x00, 0x00, 0xff, 0x87, 0x00, 0x00, 0xff, 0x82, 0x00, 0x02, 0xfe, 0x01, 0x01, 0x91, 0x00, 0x02, 0x01, 0x01, 0xfe, 0x82, 0x00, 0x00, 0xff, 0x87, 0x00, 0x00, 0xc0, 0x82, 0x20, 0x82, 0x10, 0x82, 0x88, 0x82, 0x44, 0x85, 0x22, 0x82, 0x44, 0x82, 0x88, 0x82, 0x10, 0x82, 0x20, 0x00, 0xc0, 0x83, 0x00, };
+const uint8_t bmp_logo64_data[] = { 0x8a, 0x00, 0x05, 0x01, 0x03, 0x07, 0x0f, 0x1f, 0x1f, 0x82, 0x3f, 0x86, 0x7f, 0x82, 0x3f, 0x05, 0x1f, 0x1f, 0x0f, 0x07, 0x03, 0x01, 0x93, 0x00, 0x01, 0x07, 0x3f, 0x83, 0xff, 0x05, 0xfe, 0xf0, 0xe0, 0xc0, 0x80, 0x80, 0x86, 0x00, 0x05, 0x80, 0x80, 0xc0, 0xe0, 0xf0, 0xfe, 0x83, 0xff, 0x01, 0x3f, 0x07, 0x8d, 0x00, 0x82, 0x01, 0x85, 0xff, 0x92, 0x03, 0x85, 0xff, 0x82, 0x01, 0x88, 0x00, 0x85, 0xff, 0x00, 0xfe, 0x86, 0xfc, 0x8c, 0xf8, 0x86, 0xfc, 0x00, 0xfe, 0x85, 0xff, 0x86, 0x00, 0x85, 0xff, 0x9c, 0x00, 0x85, 0xff, 0x86, 0x00, 0x85, 0xff, 0x9c, 0x00, 0x85, 0xff, 0x86, 0x00, 0x85, 0xff, 0x01, 0x1f, 0x1f, 0x82, 0x0f, 0x01, 0x07, 0x07, 0x83, 0x03, 0x01, 0x01, 0x01, 0x82, 0x00, 0x01, 0x01, 0x01, 0x83, 0x03, 0x01, 0x07, 0x07, 0x82, 0x0f, 0x01, 0x1f, 0x1f, 0x85, 0xff, 0x87, 0x00, 0x82, 0x80, 0x82, 0xc0, 0x01, 0xe0, 0xe0, 0x82, 0xf0, 0x82, 0xf8, 0x82, 0xfc, 0x84, 0xfe, 0x82, 0xfc, 0x82, 0xf8, 0x82, 0xf0, 0x01, 0xe0, 0xe0, 0x82, 0xc0, 0x82, 0x80, 0x84, 0x00, };
+const uint8_t bmp_logo64_empty_data[] = { 0x8a, 0x00, 0x05, 0x01, 0x02, 0x04, 0x08, 0x10, 0x10, 0x82, 0x20, 0x86, 0x41, 0x82, 0x20, 0x05, 0x10, 0x10, 0x08, 0x04, 0x02, 0x01, 0x93, 0x00, 0x0b, 0x07, 0x38, 0xc0, 0x00, 0x00, 0x01, 0x0e, 0x10, 0x20, 0x40, 0x80, 0x80, 0x86, 0x00, 0x0b, 0x80, 0x80, 0x40, 0x20, 0x10, 0x0e, 0x01, 0x00, 0x00, 0xc0, 0x38, 0x07, 0x8e, 0x00, 0x02, 0x01, 0x01, 0xff, 0x83, 0x00, 0x00, 0xfe, 0x92, 0x02, 0x00, 0xfe, 0x83, 0x00, 0x02, 0xff, 0x01, 0x01, 0x89, 0x00, 0x06, 0xff, 0x80, 0x80, 0x00, 0x00, 0x01, 0x02, 0x86, 0x04, 0x8c, 0x08, 0x86, 0x04, 0x06, 0x02, 0x01, 0x00, 0x00, 0x80, 0x80, 0xff, 0x86, 0x00, 0x00, 0xff, 0x83, 0x00, 0x00, 0xff, 0x9c, 0x00, 0x00, 0xff, 0x83, 0x00, 0x00, 0xff, 0x86, 0x00, 0x00, 0xff, 0x83, 0x00, 0x00, 0xff, 0x9c, 0x00, 0x00, 0xff, 0x83, 0x00, 0x00, 0xff, 0x86, 0x00, 0x00, 0xff, 0x83, 0x00, 0x02, 0xe0, 0x10, 0x10, 0x82, 0x08, 0x01, 0x04, 0x04, 0x83, 0x02, 0x01, 0x01, 0x01, 0x82, 0x00, 0x01, 0x01, 0x01, 0x83, 0x02, 0x01, 0x04, 0x04, 0x82, 0x08, 0x02, 0x10, 0x10, 0xe0, 0x83, 0x00, 0x00, 0xff, 0x87, 0x00, 0x82, 0x80, 0x82, 0x40, 0x01, 0x20, 0x20, 0x82, 0x10, 0x82, 0x08, 0x82, 0x04, 0x00, 0x02, 0x82, 0x82, 0x00, 0x02, 0x82, 0x04, 0x82, 0x08, 0x82, 0x10, 0x01, 0x20, 0x20, 0x82, 0x40, 0x82, 0x80, 0x84, 0x00, };
+const uint8_t bmp_u2f_bitbucket_data[] = { 0x09, 0x00, 0x00, 0x1f, 0x3f, 0x3f, 0x7f, 0x77, 0x77, 0x63, 0x63, 0x8a, 0xe3, 0x07, 0x63, 0x63, 0x77, 0x77, 0x7f, 0x3f, 0x3f, 0x1f, 0x84, 0x00, 0x00, 0xf0, 0x87, 0xff, 0x02, 0xf8, 0xf0, 0xe3, 0x82, 0xe7, 0x02, 0xe3, 0xf0, 0xf8, 0x87, 0xff, 0x00, 0xf0, 0x85, 0x00, 0x0a, 0x80, 0xf0, 0xfb, 0xf9, 0xfd, 0xfc, 0xfc, 0xfe, 0x3e, 0x1e, 0x8e, 0x82, 0xce, 0x0a, 0x8e, 0x1e, 0x3e, 0xfe, 0xfc, 0xfc, 0xfd, 0xf9, 0xfb, 0xf0, 0x80, 0x88, 0x00, 0x06, 0xe0, 0xf8, 0xfc, 0xfe, 0xfe, 0x7e, 0x7e, 0x86, 0x7f, 0x06, 0x7e, 0x7e, 0xfe, 0xfe, 0xfc, 0xf8, 0xe0, 0x85, 0x00, };
+const uint8_t bmp_u2f_bitfinex_data[] = { 0x8d, 0x00, 0x01, 0x01, 0x01, 0x83, 0x03, 0x84, 0x07, 0x01, 0x06, 0x07, 0x8a, 0x00, 0x05, 0x03, 0x0f, 0x1f, 0x3f, 0x7f, 0x7f, 0x84, 0xff, 0x09, 0xfe, 0xfc, 0xf8, 0xf1, 0xf3, 0xe7, 0xcf, 0x3f, 0x7f, 0xfe, 0x89, 0x00, 0x83, 0xf0, 0x10, 0xe1, 0xe1, 0xe3, 0xc3, 0xc7, 0x87, 0x0f, 0x1f, 0x3f, 0x3f, 0x7f, 0xff, 0xff, 0xfe, 0xfc, 0xf0, 0xc0, 0x8c, 0x00, 0x00, 0x80, 0x82, 0xc0, 0x84, 0xe0, 0x82, 0xc0, 0x01, 0x80, 0x80, 0x8a, 0x00, };
+const uint8_t bmp_u2f_dropbox_data[] = { 0x2b, 0x00, 0x03, 0x07, 0x07, 0x0f, 0x1f, 0x1f, 0x3f, 0x3f, 0x7f, 0x7f, 0x3f, 0x1f, 0x0f, 0x06, 0x00, 0x00, 0x06, 0x0e, 0x1f, 0x3f, 0x3f, 0x7f, 0x7f, 0x3f, 0x1f, 0x1f, 0x0f, 0x0f, 0x07, 0x03, 0x02, 0x00, 0x00, 0x81, 0xc3, 0xc3, 0xe7, 0xff, 0xff, 0xe7, 0xc3, 0xc3, 0x81, 0x87, 0x00, 0x09, 0x81, 0x81, 0xc3, 0xc7, 0xe7, 0xff, 0xef, 0xc7, 0xc3, 0x81, 0x82, 0x00, 0x1d, 0xc0, 0xc0, 0xe0, 0xf0, 0xf0, 0xf9, 0xf9, 0xfc, 0xfe, 0xfc, 0xf9, 0xf9, 0xf3, 0x67, 0x0f, 0x0f, 0x67, 0xf3, 0xf9, 0xf9, 0xfc, 0xfe, 0xfc, 0xfc, 0xf9, 0xf0, 0xf0, 0xe0, 0xe0, 0xc0, 0x86, 0x00, 0x13, 0x80, 0xc0, 0xc0, 0xe0, 0xf0, 0xf0, 0xf8, 0xfc, 0xfc, 0xfe, 0xfe, 0xfc, 0xfc, 0xf8, 0xf8, 0xf0, 0x60, 0xe0, 0xc0, 0x80, 0x85, 0x00, };
+const uint8_t bmp_u2f_fastmail_data[] = { 0x03, 0x00, 0x01, 0x04, 0x06, 0x97, 0x07, 0x0f, 0x06, 0x04, 0x01, 0x00, 0x00, 0xff, 0xff, 0x7f, 0x3f, 0x9f, 0xcf, 0xe7, 0xf3, 0xf9, 0xfc, 0xfe, 0x87, 0xff, 0x0c, 0xfe, 0xfc, 0xf9, 0xf3, 0xe7, 0xcf, 0x9f, 0x3f, 0x7f, 0xff, 0xff, 0x00, 0x00, 0x89, 0xff, 0x02, 0x7f, 0x3f, 0x9f, 0x83, 0xcf, 0x02, 0x9f, 0x3f, 0x7f, 0x89, 0xff, 0x02, 0x00, 0x00, 0xc0, 0x9b, 0xe0, 0x01, 0xc0, 0x00, };
+const uint8_t bmp_u2f_gandi_data[] = { 0x86, 0x00, 0x06, 0x01, 0x01, 0x00, 0x00, 0x1e, 0x3f, 0x7f, 0x82, 0x73, 0x02, 0x7f, 0x3f, 0x1e, 0x82, 0x00, 0x00, 0x01, 0x8d, 0x00, 0x06, 0xc0, 0xf0, 0xf8, 0xf8, 0x7c, 0x3d, 0x1f, 0x84, 0x9f, 0x06, 0x1e, 0x3e, 0x3c, 0x7c, 0xf8, 0xf0, 0xe0, 0x8e, 0x00, 0x0f, 0x1f, 0x7f, 0xff, 0xff, 0xf0, 0xe0, 0xc2, 0x87, 0x8f, 0x0f, 0x1e, 0x1e, 0x0f, 0x0f, 0x07, 0x03, 0x8f, 0x00, 0x0f, 0xc0, 0xf0, 0xf8, 0xfc, 0x3e, 0x1e, 0x1e, 0x0e, 0x8e, 0x1e, 0x1e, 0x3e, 0xfc, 0xf8, 0xf0, 0xe0, 0x87, 0x00, };
+const uint8_t bmp_u2f_github_data[] = { 0x82, 0x00, 0x83, 0x1f, 0x03, 0x0f, 0x0f, 0x07, 0x07, 0x8a, 0x03, 0x02, 0x07, 0x0f, 0x0f, 0x83, 0x1f, 0x82, 0x00, 0x02, 0x03, 0x0f, 0x3f, 0x84, 0xff, 0x85, 0xfe, 0x83, 0xff, 0x85, 0xfe, 0x84, 0xff, 0x0f, 0x3f, 0x0f, 0x03, 0xf0, 0xfe, 0xff, 0xff, 0xe0, 0x80, 0x00, 0x00, 0x0c, 0x1f, 0x3f, 0x1f, 0x04, 0x85, 0x00, 0x15, 0x04, 0x1f, 0x3f, 0x1f, 0x0c, 0x00, 0x00, 0x80, 0xe0, 0xff, 0xff, 0xfe, 0xf0, 0x00, 0x00, 0x80, 0xc0, 0xe0, 0x70, 0x30, 0x18, 0x18, 0x8d, 0x08, 0x08, 0x18, 0x18, 0x30, 0x70, 0xe0, 0xc0, 0x80, 0x00, 0x00, };
+const uint8_t bmp_u2f_gitlab_data[] = { 0x83, 0x00, 0x03, 0x07, 0x3f, 0x7f, 0x0f, 0x8f, 0x00, 0x04, 0x07, 0x3f, 0x7f, 0x0f, 0x01, 0x83, 0x00, 0x01, 0x03, 0x1f, 0x85, 0xff, 0x00, 0x1f, 0x8b, 0x07, 0x00, 0x1f, 0x85, 0xff, 0x08, 0x1f, 0x03, 0x00, 0x60, 0xf0, 0xf8, 0xfc, 0xfc, 0xfe, 0x93, 0xff, 0x05, 0xfe, 0xfc, 0xfc, 0xf8, 0xf0, 0x70, 0x86, 0x00, 0x11, 0x80, 0x80, 0xc0, 0xe0, 0xf0, 0xf0, 0xf8, 0xfc, 0xfe, 0xfe, 0xfc, 0xf8, 0xf0, 0xf0, 0xe0, 0xc0, 0x80, 0x80, 0x86, 0x00, };
+const uint8_t bmp_u2f_google_data[] = { 0x0b, 0x00, 0x00, 0x01, 0x03, 0x07, 0x0f, 0x1f, 0x3e, 0x3c, 0x7c, 0x78, 0x78, 0x87, 0xf0, 0x11, 0x78, 0x78, 0x7c, 0x3e, 0x3f, 0x1f, 0x0f, 0x07, 0x03, 0x01, 0x00, 0x00, 0x0f, 0x7f, 0xff, 0xff, 0xf0, 0xc0, 0x82, 0x00, 0x02, 0x07, 0x1f, 0x3f, 0x83, 0x7f, 0x83, 0x7c, 0x02, 0x3c, 0x3c, 0x7c, 0x83, 0xfc, 0x82, 0xff, 0x07, 0x7f, 0x0f, 0xf0, 0xfe, 0xff, 0xff, 0x0f, 0x03, 0x82, 0x00, 0x03, 0xe0, 0xf8, 0xfc, 0xfc, 0x82, 0xfe, 0x83, 0x3e, 0x06, 0x3c, 0x38, 0x30, 0x00, 0x00, 0x01, 0x07, 0x82, 0xff, 0x0d, 0xfe, 0xf0, 0x00, 0x00, 0x80, 0xc0, 0xe0, 0xf0, 0xf8, 0x7c, 0x3c, 0x3e, 0x1e, 0x1e, 0x87, 0x0f, 0x0b, 0x1e, 0x1e, 0x3e, 0x3c, 0xfc, 0xf8, 0xf0, 0xe0, 0xc0, 0x80, 0x00, 0x00, };
+const uint8_t bmp_u2f_slushpool_data[] = { 0x85, 0x00, 0x00, 0x01, 0x87, 0x0f, 0x00, 0x1f, 0x82, 0x7f, 0x00, 0x0f, 0x82, 0x7f, 0x04, 0x6f, 0x07, 0x07, 0x03, 0x01, 0x89, 0x00, 0x01, 0x80, 0x87, 0x85, 0xff, 0x00, 0xe0, 0x84, 0x80, 0x01, 0xc0, 0xc1, 0x85, 0xff, 0x00, 0xfc, 0x86, 0x00, 0x02, 0x7c, 0x7d, 0x7f, 0x84, 0xff, 0x01, 0xfc, 0xfc, 0x84, 0x7c, 0x82, 0xfc, 0x05, 0xf8, 0xf8, 0xf0, 0xf0, 0xe0, 0x80, 0x87, 0x00, 0x00, 0x0e, 0x85, 0xfe, 0x00, 0xc0, 0x93, 0x00, };
+const uint8_t bmp_u2f_yubico_data[] = { 0x0a, 0x00, 0x00, 0x01, 0x03, 0x07, 0x0f, 0x1f, 0x3e, 0x3c, 0x78, 0x78, 0x82, 0xf0, 0x83, 0xe0, 0x82, 0xf0, 0x10, 0x78, 0x78, 0x3c, 0x3c, 0x1e, 0x0f, 0x07, 0x03, 0x01, 0x00, 0x00, 0x1f, 0x7f, 0xff, 0xfc, 0xe0, 0x80, 0x82, 0x00, 0x01, 0xe0, 0xf8, 0x82, 0xff, 0x17, 0x1f, 0x07, 0x00, 0x07, 0x3f, 0xff, 0xff, 0xfe, 0xf0, 0xc0, 0x00, 0x00, 0x80, 0xc0, 0xfc, 0xff, 0x7f, 0x1f, 0xf8, 0xfe, 0xff, 0x3f, 0x07, 0x01, 0x85, 0x00, 0x01, 0xe0, 0xfb, 0x83, 0xff, 0x02, 0xfc, 0xf0, 0x80, 0x84, 0x00, 0x13, 0x01, 0x03, 0x3f, 0xff, 0xff, 0xf8, 0x00, 0x00, 0x80, 0xc0, 0xe0, 0xf0, 0x78, 0x3c, 0x3c, 0x1e, 0x0e, 0x0f, 0xef, 0xef, 0x82, 0xe7, 0x00, 0x87, 0x82, 0x0f, 0x0a, 0x0e, 0x1e, 0x3e, 0x3c, 0x78, 0xf0, 0xe0, 0xc0, 0x80, 0x00, 0x00, };
 
-const BITMAP bmp_digit0 = {16, 16, bmp_digit0_data};
-const BITMAP bmp_digit1 = {16, 16, bmp_digit1_data};
-const BITMAP bmp_digit2 = {16, 16, bmp_digit2_data};
-const BITMAP bmp_digit3 = {16, 16, bmp_digit3_data};
-const BITMAP bmp_digit4 = {16, 16, bmp_digit4_data};
-const BITMAP bmp_digit5 = {16, 16, bmp_digit5_data};
-const BITMAP bmp_digit6 = {16, 16, bmp_digit6_data};
-const BITMAP bmp_digit7 = {16, 16, bmp_digit7_data};
-const BITMAP bmp_digit8 = {16, 16, bmp_digit8_data};
-const BITMAP bmp_digit9 = {16, 16, bmp_digit9_data};
-const BITMAP bmp_gears0 = {48, 48, bmp_gears0_data};
-const BITMAP bmp_gears1 = {48, 48, bmp_gears1_data};
-const BITMAP bmp_gears2 = {48, 48, bmp_gears2_data};
-const BITMAP bmp_gears3 = {48, 48, bmp_gears3_data};
-const BITMAP bmp_icon_error = {16, 16, bmp_icon_error_data};
-const BITMAP bmp_icon_info = {16, 16, bmp_icon_info_data};
-const BITMAP bmp_icon_ok = {16, 16, bmp_icon_ok_data};
-const BITMAP bmp_icon_question = {16, 16, bmp_icon_question_data};
-const BITMAP bmp_icon_warning = {16, 16, bmp_icon_warning_data};
-const BITMAP bmp_logo48 = {40, 48, bmp_logo48_data};
-const BITMAP bmp_logo48_empty = {40, 48, bmp_logo48_empty_data};
-const BITMAP bmp_logo64 = {48, 64, bmp_logo64_data};
-const BITMAP bmp_logo64_empty = {48, 64, bmp_logo64_empty_data};
-const BITMAP bmp_u2f_bitbucket = {32, 32, bmp_u2f_bitbucket_data};
-const BITMAP bmp_u2f_bitfinex = {32, 32, bmp_u2f_bitfinex_data};
-const BITMAP bmp_u2f_dropbox = {32, 32, bmp_u2f_dropbox_data};
-const BITMAP bmp_u2f_fastmail = {32, 32, bmp_u2f_fastmail_data};
-const BITMAP bmp_u2f_gandi = {32, 32, bmp_u2f_gandi_data};
-const BITMAP bmp_u2f_github = {32, 32, bmp_u2f_github_data};
-const BITMAP bmp_u2f_gitlab = {32, 32, bmp_u2f_gitlab_data};
-const BITMAP bmp_u2f_google = {32, 32, bmp_u2f_google_data};
-const BITMAP bmp_u2f_slushpool = {32, 32, bmp_u2f_slushpool_data};
-const BITMAP bmp_u2f_yubico = {32, 32, bmp_u2f_yubico_data};
+const BITMAP bmp_digit0 = {16, 16, bmp_digit0_data, 1};
+const BITMAP bmp_digit1 = {16, 16, bmp_digit1_data, 1};
+const BITMAP bmp_digit2 = {16, 16, bmp_digit2_data, 1};
+const BITMAP bmp_digit3 = {16, 16, bmp_digit3_data, 1};
+const BITMAP bmp_digit4 = {16, 16, bmp_digit4_data, 1};
+const BITMAP bmp_digit5 = {16, 16, bmp_digit5_data, 1};
+const BITMAP bmp_digit6 = {16, 16, bmp_digit6_data, 1};
+const BITMAP bmp_digit7 = {16, 16, bmp_digit7_data, 1};
+const BITMAP bmp_digit8 = {16, 16, bmp_digit8_data, 1};
+const BITMAP bmp_digit9 = {16, 16, bmp_digit9_data, 1};
+const BITMAP bmp_gears0 = {48, 48, bmp_gears0_data, 1};
+const BITMAP bmp_gears1 = {48, 48, bmp_gears1_data, 1};
+const BITMAP bmp_gears2 = {48, 48, bmp_gears2_data, 1};
+const BITMAP bmp_gears3 = {48, 48, bmp_gears3_data, 1};
+const BITMAP bmp_icon_error = {16, 16, bmp_icon_error_data, 0};
+const BITMAP bmp_icon_info = {16, 16, bmp_icon_info_data, 0};
+const BITMAP bmp_icon_ok = {16, 16, bmp_icon_ok_data, 0};
+const BITMAP bmp_icon_question = {16, 16, bmp_icon_question_data, 0};
+const BITMAP bmp_icon_warning = {16, 16, bmp_icon_warning_data, 1};
+const BITMAP bmp_logo48 = {40, 48, bmp_logo48_data, 1};
+const BITMAP bmp_logo48_empty = {40, 48, bmp_logo48_empty_data, 1};
+const BITMAP bmp_logo64 = {48, 64, bmp_logo64_data, 1};
+const BITMAP bmp_logo64_empty = {48, 64, bmp_logo64_empty_data, 1};
+const BITMAP bmp_u2f_bitbucket = {32, 32, bmp_u2f_bitbucket_data, 1};
+const BITMAP bmp_u2f_bitfinex = {32, 32, bmp_u2f_bitfinex_data, 1};
+const BITMAP bmp_u2f_dropbox = {32, 32, bmp_u2f_dropbox_data, 1};
+const BITMAP bmp_u2f_fastmail = {32, 32, bmp_u2f_fastmail_data, 1};
+const BITMAP bmp_u2f_gandi = {32, 32, bmp_u2f_gandi_data, 1};
+const BITMAP bmp_u2f_github = {32, 32, bmp_u2f_github_data, 1};
+const BITMAP bmp_u2f_gitlab = {32, 32, bmp_u2f_gitlab_data, 1};
+const BITMAP bmp_u2f_google = {32, 32, bmp_u2f_google_data, 1};
+const BITMAP bmp_u2f_slushpool = {32, 32, bmp_u2f_slushpool_data, 1};
+const BITMAP bmp_u2f_yubico = {32, 32, bmp_u2f_yubico_data, 1};
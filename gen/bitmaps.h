@@ -3,9 +3,12 @@
 
 #include <stdint.h>
 
+// data holds rows (MSB leftmost), or with packed set the compressed
+// columns written by pack_pixels() in gen/bitmaps/generate.py
 typedef struct {
 	uint8_t width, height;
 	const uint8_t *data;
+	uint8_t packed;
 } BITMAP;
 
 extern const BITMAP bmp_digit0;
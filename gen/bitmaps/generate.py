@@ -9,13 +9,52 @@ data = []
 imgs = []
 
 def encode_pixels(img):
-	r = ''
+	r = []
 	img = [ (x[0] + x[1] + x[2] > 384 and '1' or '0') for x in img]
 	for i in range(len(img) // 8):
 		c = ''.join(img[i * 8 : i * 8 + 8])
-		r += '0x%02x, ' % int(c, 2)
+		r.append(int(c, 2))
 	return r
 
+# Packed bitmaps are stored the way oled.c lays out the display: one byte
+# per column of 8 rows (top row in the MSB), band by band, compressed with
+# runs (0x80 | n-1, byte) and literals (n-1, n bytes).
+def pack_pixels(rows, w, h):
+	stride = w // 8
+	cols = []
+	for band in range(0, h, 8):
+		for x in range(w):
+			b = 0
+			for k in range(min(8, h - band)):
+				if rows[(band + k) * stride + x // 8] & (0x80 >> (x % 8)):
+					b |= 0x80 >> k
+			cols.append(b)
+	r = []
+	lit = []
+	def flush():
+		while lit:
+			n = min(len(lit), 128)
+			r.append(n - 1)
+			r.extend(lit[:n])
+			del lit[:n]
+	i = 0
+	while i < len(cols):
+		j = i
+		while j < len(cols) and cols[j] == cols[i] and j - i < 128:
+			j += 1
+		if j - i >= 3:
+			flush()
+			r.extend([0x80 | (j - i - 1), cols[i]])
+			i = j
+		else:
+			lit.append(cols[i])
+			i += 1
+	flush()
+	return r
+
+def format_bytes(b):
+	return ''.join('0x%02x, ' % x for x in b)
+
 cnt = 0
 for fn in sorted(glob.glob('*.png')):
 	print('Processing:', fn)
@@ -25,9 +64,15 @@ for fn in sorted(glob.glob('*.png')):
 	if w % 8 != 0:
 		raise Exception('Width must be divisable by 8! (%s is %dx%d)' % (fn, w, h))
 	img = list(im.getdata())
+	rows = encode_pixels(img)
+	packed = pack_pixels(rows, w, h)
 	hdrs.append('extern const BITMAP bmp_%s;\n' % name)
-	imgs.append('const BITMAP bmp_%s = {%d, %d, bmp_%s_data};\n' % (name, w, h, name))
-	data.append('const uint8_t bmp_%s_data[] = { %s};\n' % (name, encode_pixels(img)))
+	if len(packed) < len(rows):
+		imgs.append('const BITMAP bmp_%s = {%d, %d, bmp_%s_data, 1};\n' % (name, w, h, name))
+		data.append('const uint8_t bmp_%s_data[] = { %s};\n' % (name, format_bytes(packed)))
+	else:
+		imgs.append('const BITMAP bmp_%s = {%d, %d, bmp_%s_data, 0};\n' % (name, w, h, name))
+		data.append('const uint8_t bmp_%s_data[] = { %s};\n' % (name, format_bytes(rows)))
 	cnt += 1
 
 with open('../bitmaps.c', 'wt') as f:
@@ -45,9 +90,12 @@ with open('../bitmaps.h', 'wt') as f:
 
 #include <stdint.h>
 
+// data holds rows (MSB leftmost), or with packed set the compressed
+// columns written by pack_pixels() in gen/bitmaps/generate.py
 typedef struct {
 	uint8_t width, height;
 	const uint8_t *data;
+	uint8_t packed;
 } BITMAP;
 
 ''')
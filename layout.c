@@ -21,6 +21,7 @@
 
 #include "layout.h"
 #include "oled.h"
+#include "timer.h"
 
 void layoutDialog(const BITMAP *icon, const char *btnNo, const char *btnYes, const char *desc, const char *line1, const char *line2, const char *line3, const char *line4, const char *line5, const char *line6)
 {
@@ -59,6 +60,44 @@ void layoutDialog(const BITMAP *icon, const char *btnNo, const char *btnYes, con
 	oledRefresh();
 }
 
+// progress screens are refreshed at most this often, except for the first
+// and the final frame and when the description changes; a frame held back
+// is shown by layoutProgressFlush()
+#define LAYOUT_PROGRESS_INTERVAL_MS 40
+
+static struct {
+	uint32_t generation;   // oledGeneration() of the progress screen shown
+	bool labelled;         // desc holds the text shown, false if too long
+	char desc[64];
+	int width;             // filled bar columns
+	uint32_t last;         // timer_ms() of the last refresh
+	bool pending;          // a refresh was held back
+	LayoutProgressStats stats;
+} progress;
+
+static void layoutProgressShow(void)
+{
+	uint32_t now = timer_ms();
+	progress.pending = false;
+	oledRefresh();
+	progress.last = timer_ms();
+	progress.stats.frames++;
+	progress.stats.display_ms += progress.last - now;
+}
+
+static void layoutProgressRefresh(bool force)
+{
+	progress.stats.updates++;
+	// timer_ms() stays at zero where the timer is not running (bootloader),
+	// do not coalesce anything there
+	uint32_t now = timer_ms();
+	if (!force && now != 0 && now - progress.last < LAYOUT_PROGRESS_INTERVAL_MS) {
+		progress.pending = true;
+		return;
+	}
+	layoutProgressShow();
+}
+
 void layoutProgressUpdate(bool refresh)
 {
 	static uint8_t step = 0;
@@ -78,29 +117,75 @@ void layoutProgressUpdate(bool refresh)
 	}
 	step = (step + 1) % 4;
 	if (refresh) {
-		oledRefresh();
+		layoutProgressRefresh(false);
 	}
 }
 
 void layoutProgress(const char *desc, int permil)
 {
-	oledClear();
-	layoutProgressUpdate(false);
-	// progressbar
-	oledFrame(0, OLED_HEIGHT - 8, OLED_WIDTH - 1, OLED_HEIGHT - 1);
-	oledBox(1, OLED_HEIGHT - 7, OLED_WIDTH - 2, OLED_HEIGHT - 2, 0);
-	permil = permil * (OLED_WIDTH - 4) / 1000;
-	if (permil < 0) {
-		permil = 0;
+	int width = permil * (OLED_WIDTH - 4) / 1000;
+	if (width < 0) {
+		width = 0;
 	}
-	if (permil > OLED_WIDTH - 4) {
-		permil = OLED_WIDTH - 4;
+	if (width > OLED_WIDTH - 4) {
+		width = OLED_WIDTH - 4;
 	}
-	oledBox(2, OLED_HEIGHT - 6, 1 + permil, OLED_HEIGHT - 3, 1);
+
+	const char *text = desc ? desc : "";
+	bool relabel = !progress.labelled || strcmp(text, progress.desc) != 0;
+	// every fresh draw clears the buffer, so a shown screen is never generation 0
+	if (progress.generation == 0 || progress.generation != oledGeneration()) {
+		oledClear();
+		// progressbar
+		oledFrame(0, OLED_HEIGHT - 8, OLED_WIDTH - 1, OLED_HEIGHT - 1);
+		oledBox(1, OLED_HEIGHT - 7, OLED_WIDTH - 2, OLED_HEIGHT - 2, 0);
+		oledBox(2, OLED_HEIGHT - 6, 1 + width, OLED_HEIGHT - 3, 1);
+		relabel = true;
+	} else if (width > progress.width) {
+		oledBox(2 + progress.width, OLED_HEIGHT - 6, 1 + width, OLED_HEIGHT - 3, 1);
+	} else if (width < progress.width) {
+		oledBox(2 + width, OLED_HEIGHT - 6, 1 + progress.width, OLED_HEIGHT - 3, 0);
+	}
+	layoutProgressUpdate(false);
 	// text
-	oledBox(0, OLED_HEIGHT - 16, OLED_WIDTH - 1, OLED_HEIGHT - 16 + 7, 0);
-	if (desc) {
-		oledDrawStringCenter(OLED_HEIGHT - 16, desc);
+	if (relabel) {
+		oledBox(0, OLED_HEIGHT - 16, OLED_WIDTH - 1, OLED_HEIGHT - 16 + 7, 0);
+		oledDrawStringCenter(OLED_HEIGHT - 16, text);
+		size_t len = strlen(text);
+		progress.labelled = len < sizeof(progress.desc);
+		if (progress.labelled) {
+			memcpy(progress.desc, text, len + 1);
+		}
 	}
-	oledRefresh();
+	progress.generation = oledGeneration();
+	progress.width = width;
+	layoutProgressRefresh(relabel || permil >= 1000 || width == OLED_WIDTH - 4);
+}
+
+/*
+ * Show the progress frame held back by the frame rate cap once the cap
+ * allows it, so the last update before a pause is not left off the
+ * display. Called from the main loop (usbPoll). A frame is dropped once
+ * another layout has replaced the progress screen.
+ */
+void layoutProgressFlush(void)
+{
+	if (!progress.pending) {
+		return;
+	}
+	if (progress.generation != oledGeneration()) {
+		progress.pending = false;
+		return;
+	}
+	if (timer_ms() - progress.last >= LAYOUT_PROGRESS_INTERVAL_MS) {
+		layoutProgressShow();
+	}
+}
+
+/*
+ * Counters summed over all progress screens shown so far.
+ */
+const LayoutProgressStats *layoutProgressStats(void)
+{
+	return &progress.stats;
 }
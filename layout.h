@@ -21,11 +21,24 @@
 #define __LAYOUT_H__
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <stdbool.h>
 #include "bitmaps.h"
 
+// Display work done for progress screens: layoutProgress*() calls, frames
+// actually sent to the display and the time spent sending them. The time
+// is sampled with the 1 ms system tick, so it is only accurate summed over
+// many frames.
+typedef struct {
+	uint32_t updates;
+	uint32_t frames;
+	uint32_t display_ms;
+} LayoutProgressStats;
+
 void layoutDialog(const BITMAP *icon, const char *btnNo, const char *btnYes, const char *desc, const char *line1, const char *line2, const char *line3, const char *line4, const char *line5, const char *line6);
 void layoutProgressUpdate(bool refresh);
 void layoutProgress(const char *desc, int permil);
+void layoutProgressFlush(void);
+const LayoutProgressStats *layoutProgressStats(void);
 
 #endif
@@ -23,6 +23,7 @@
 #include <string.h>
 
 #include "oled.h"
+#include "timer.h"
 #include "util.h"
 
 #define OLED_SETCONTRAST		0x81
@@ -46,6 +47,8 @@
 #define OLED_COMSCANDEC			0xC8
 #define OLED_SEGREMAP			0xA0
 #define OLED_CHARGEPUMP			0x8D
+#define OLED_SETCOLUMNADDR		0x21
+#define OLED_SETPAGEADDR		0x22
 
 #define SPI_BASE			SPI1
 #define OLED_DC_PORT			GPIOB
@@ -63,15 +66,209 @@
  * display.
  */
 
-static uint8_t _oledbuffer[OLED_BUFSIZE];
+static uint8_t _oledbuffers[2][OLED_BUFSIZE];
+static uint8_t *_oledbuffer = _oledbuffers[0];
 static bool is_debug_link = 0;
 
+/*
+ * A running swipe animation. The outgoing screen is shifted out in
+ * _oledbuffers[1], one frame per oledAnimate() call as time advances,
+ * while the caller already draws the next screen into _oledbuffer. That
+ * screen is shown once the animation is over.
+ */
+#define OLED_SWIPE_LEFT_MS		256
+#define OLED_SWIPE_RIGHT_MS		64
+
+static struct {
+	bool active;
+	bool left;
+	uint32_t start;
+	uint32_t duration;
+	int shown;		// columns shifted out so far
+} _oledswipe;
+
+/*
+ * Columns of each buffer page (OLED_WIDTH bytes) touched since the last
+ * refresh; a page is clean when start > end. _oledsent holds what the
+ * display currently shows, so that touched but unchanged columns (e.g. a
+ * screen cleared and redrawn with mostly the same content) are not sent.
+ */
+static struct {
+	uint8_t start, end;
+} _oleddirty[OLED_HEIGHT / 8] = { [0 ... OLED_HEIGHT / 8 - 1] = { 0, OLED_WIDTH - 1 } };
+static uint8_t _oledsent[OLED_BUFSIZE];
+static bool _oledsynced = false;
+
+// bumped whenever the whole buffer is replaced, see oledGeneration()
+static uint32_t _oledgeneration = 0;
+
 /*
  * macros to convert coordinate to bit position
  */
 #define OLED_OFFSET(x, y) (OLED_BUFSIZE - 1 - (x) - ((y)/8)*OLED_WIDTH)
 #define OLED_MASK(x, y)   (1 << (7 - (y) % 8))
 
+static inline void oledMarkDirty(int offset)
+{
+	int page = offset / OLED_WIDTH, col = offset % OLED_WIDTH;
+	if (col < _oleddirty[page].start) _oleddirty[page].start = col;
+	if (col > _oleddirty[page].end) _oleddirty[page].end = col;
+}
+
+/*
+ * Combine 8 vertically adjacent pixels (top row in the MSB, like font
+ * columns) into column x at rows y..y+7: pixels in mask are replaced by
+ * bits, the rest is kept. Rows may straddle two buffer pages.
+ */
+static inline void oledBlitColumn(int x, int y, uint8_t bits, uint8_t mask)
+{
+	if (x < 0 || x >= OLED_WIDTH || y >= OLED_HEIGHT || y <= -8) {
+		return;
+	}
+	bits &= mask;
+	int page = (y + 8) / 8 - 1;	// rounds down for y > -8
+	int shift = y - page * 8;
+	if (page >= 0) {
+		int offset = OLED_OFFSET(x, page * 8);
+		_oledbuffer[offset] = (_oledbuffer[offset] & ~(mask >> shift)) | (bits >> shift);
+		oledMarkDirty(offset);
+	}
+	if (shift > 0 && page + 1 < OLED_HEIGHT / 8) {
+		int offset = OLED_OFFSET(x, page * 8 + 8);
+		_oledbuffer[offset] = (_oledbuffer[offset] & ~(uint8_t)(mask << (8 - shift))) | (uint8_t)(bits << (8 - shift));
+		oledMarkDirty(offset);
+	}
+}
+
+/*
+ * Transpose an 8x8 block of bitmap rows (MSB leftmost) into columns
+ * (MSB topmost), see Hacker's Delight 7-3.
+ */
+static void oledTranspose8(const uint8_t rows[8], uint8_t cols[8])
+{
+	uint32_t x = ((uint32_t)rows[0] << 24) | (rows[1] << 16) | (rows[2] << 8) | rows[3];
+	uint32_t y = ((uint32_t)rows[4] << 24) | (rows[5] << 16) | (rows[6] << 8) | rows[7];
+	uint32_t t;
+
+	t = (x ^ (x >> 7)) & 0x00AA00AA; x = x ^ t ^ (t << 7);
+	t = (y ^ (y >> 7)) & 0x00AA00AA; y = y ^ t ^ (t << 7);
+	t = (x ^ (x >> 14)) & 0x0000CCCC; x = x ^ t ^ (t << 14);
+	t = (y ^ (y >> 14)) & 0x0000CCCC; y = y ^ t ^ (t << 14);
+	t = (x & 0xF0F0F0F0) | ((y >> 4) & 0x0F0F0F0F);
+	y = ((x << 4) & 0xF0F0F0F0) | (y & 0x0F0F0F0F);
+	x = t;
+
+	cols[0] = x >> 24; cols[1] = x >> 16; cols[2] = x >> 8; cols[3] = x;
+	cols[4] = y >> 24; cols[5] = y >> 16; cols[6] = y >> 8; cols[7] = y;
+}
+
+/*
+ * Apply op to the box between (x1,y1) and (x2,y2) inclusive, a whole
+ * page byte at a time.
+ */
+enum { OLED_OP_CLEAR, OLED_OP_SET, OLED_OP_INVERT };
+
+static void oledBoxOp(int x1, int y1, int x2, int y2, int op)
+{
+	x1 = MAX(x1, 0);
+	y1 = MAX(y1, 0);
+	x2 = MIN(x2, OLED_WIDTH - 1);
+	y2 = MIN(y2, OLED_HEIGHT - 1);
+	if (x1 > x2 || y1 > y2) {
+		return;
+	}
+	for (int page = y1 / 8; page <= y2 / 8; page++) {
+		int top = MAX(y1 - page * 8, 0);
+		int bottom = MIN(y2 - page * 8, 7);
+		uint8_t mask = (0xFF >> top) & (uint8_t)(0xFF << (7 - bottom));
+		// x grows towards lower offsets
+		uint8_t *p = _oledbuffer + OLED_OFFSET(x2, page * 8);
+		for (int i = 0; i <= x2 - x1; i++) {
+			switch (op) {
+				case OLED_OP_CLEAR:  p[i] &= ~mask; break;
+				case OLED_OP_SET:    p[i] |= mask;  break;
+				case OLED_OP_INVERT: p[i] ^= mask;  break;
+			}
+		}
+		oledMarkDirty(OLED_OFFSET(x1, page * 8));
+		oledMarkDirty(OLED_OFFSET(x2, page * 8));
+	}
+}
+
+static void oledMarkDirtyAll(void)
+{
+	for (int i = 0; i < OLED_HEIGHT / 8; i++) {
+		_oleddirty[i].start = 0;
+		_oleddirty[i].end = OLED_WIDTH - 1;
+	}
+}
+
+static void oledTrimDirty(int page)
+{
+	const uint8_t *buf = _oledbuffer + page * OLED_WIDTH;
+	const uint8_t *sent = _oledsent + page * OLED_WIDTH;
+	int start = _oleddirty[page].start, end = _oleddirty[page].end;
+	while (start <= end && buf[start] == sent[start]) start++;
+	while (end >= start && buf[end] == sent[end]) end--;
+	if (start > end) {
+		_oleddirty[page].start = OLED_WIDTH;
+		_oleddirty[page].end = 0;
+	} else {
+		_oleddirty[page].start = start;
+		_oleddirty[page].end = end;
+	}
+}
+
+/*
+ * Record the dirty windows as sent to the display. Must be called while
+ * the buffer still holds exactly what was sent.
+ */
+void oledMarkClean(void)
+{
+	for (int i = 0; i < OLED_HEIGHT / 8; i++) {
+		if (_oleddirty[i].start <= _oleddirty[i].end) {
+			memcpy(_oledsent + i * OLED_WIDTH + _oleddirty[i].start,
+				_oledbuffer + i * OLED_WIDTH + _oleddirty[i].start,
+				_oleddirty[i].end - _oleddirty[i].start + 1);
+		}
+		_oleddirty[i].start = OLED_WIDTH;
+		_oleddirty[i].end = 0;
+	}
+	_oledsynced = true;
+}
+
+/*
+ * Find the next window of dirty pages at or after *page. Consecutive
+ * pages with the same dirty columns are merged into one window.
+ */
+bool oledDirtyWindow(int *page, OledWindow *window)
+{
+	for (; *page < OLED_HEIGHT / 8; (*page)++) {
+		if (_oledsynced) {
+			oledTrimDirty(*page);
+		}
+		if (_oleddirty[*page].start <= _oleddirty[*page].end) {
+			break;
+		}
+	}
+	if (*page >= OLED_HEIGHT / 8) {
+		return false;
+	}
+	window->page_start = *page;
+	window->col_start = _oleddirty[*page].start;
+	window->col_end = _oleddirty[*page].end;
+	while (++(*page) < OLED_HEIGHT / 8) {
+		if (_oledsynced) {
+			oledTrimDirty(*page);
+		}
+		if (_oleddirty[*page].start != window->col_start || _oleddirty[*page].end != window->col_end) {
+			break;
+		}
+	}
+	window->page_end = *page - 1;
+	return true;
+}
+
 /*
  * Draws a white pixel at x, y
  */
@@ -81,6 +278,7 @@ void oledDrawPixel(int x, int y)
 		return;
 	}
 	_oledbuffer[OLED_OFFSET(x, y)] |= OLED_MASK(x, y);
+	oledMarkDirty(OLED_OFFSET(x, y));
 }
 
 /*
@@ -92,6 +290,7 @@ void oledClearPixel(int x, int y)
 		return;
 	}
 	_oledbuffer[OLED_OFFSET(x, y)] &= ~OLED_MASK(x, y);
+	oledMarkDirty(OLED_OFFSET(x, y));
 }
 
 /*
@@ -103,6 +302,7 @@ void oledInvertPixel(int x, int y)
 		return;
 	}
 	_oledbuffer[OLED_OFFSET(x, y)] ^= OLED_MASK(x, y);
+	oledMarkDirty(OLED_OFFSET(x, y));
 }
 
 #if !EMULATOR
@@ -177,7 +377,9 @@ void oledInit()
  */
 void oledClear()
 {
-	memset(_oledbuffer, 0, sizeof(_oledbuffer));
+	memset(_oledbuffer, 0, OLED_BUFSIZE);
+	oledMarkDirtyAll();
+	_oledgeneration++;
 }
 
 void oledInvertDebugLink()
@@ -195,25 +397,47 @@ void oledInvertDebugLink()
  * Refresh the display. This copies the buffer to the display to show the
  * contents.  This must be called after every operation to the buffer to
  * make the change visible.  All other operations only change the buffer
- * not the content of the display.
+ * not the content of the display.  While a swipe is running, this only
+ * advances the animation.
  */
-#if !EMULATOR
 void oledRefresh()
 {
-	static const uint8_t s[3] = {OLED_SETLOWCOLUMN | 0x00, OLED_SETHIGHCOLUMN | 0x00, OLED_SETSTARTLINE | 0x00};
+	if (_oledswipe.active) {
+		oledAnimate();
+		return;
+	}
+	oledFlush();
+}
 
+/*
+ * Send the changed parts of the buffer to the display.
+ */
+#if !EMULATOR
+void oledFlush()
+{
 	// draw triangle in upper right corner
 	oledInvertDebugLink();
 
-	gpio_clear(OLED_CS_PORT, OLED_CS_PIN);		// SPI select
-	SPISend(SPI_BASE, s, 3);
-	gpio_set(OLED_CS_PORT, OLED_CS_PIN);		// SPI deselect
+	// only send the changed windows, using horizontal addressing mode
+	int page = 0;
+	OledWindow w;
+	while (oledDirtyWindow(&page, &w)) {
+		const uint8_t s[6] = {OLED_SETCOLUMNADDR, w.col_start, w.col_end, OLED_SETPAGEADDR, w.page_start, w.page_end};
 
-	gpio_set(OLED_DC_PORT, OLED_DC_PIN);		// set to DATA
-	gpio_clear(OLED_CS_PORT, OLED_CS_PIN);		// SPI select
-	SPISend(SPI_BASE, _oledbuffer, sizeof(_oledbuffer));
-	gpio_set(OLED_CS_PORT, OLED_CS_PIN);		// SPI deselect
-	gpio_clear(OLED_DC_PORT, OLED_DC_PIN);		// set to CMD
+		gpio_clear(OLED_CS_PORT, OLED_CS_PIN);		// SPI select
+		SPISend(SPI_BASE, s, 6);
+		gpio_set(OLED_CS_PORT, OLED_CS_PIN);		// SPI deselect
+
+		gpio_set(OLED_DC_PORT, OLED_DC_PIN);		// set to DATA
+		gpio_clear(OLED_CS_PORT, OLED_CS_PIN);		// SPI select
+		for (int p = w.page_start; p <= w.page_end; p++) {
+			SPISend(SPI_BASE, _oledbuffer + p * OLED_WIDTH + w.col_start, w.col_end - w.col_start + 1);
+		}
+		gpio_set(OLED_CS_PORT, OLED_CS_PIN);		// SPI deselect
+		gpio_clear(OLED_DC_PORT, OLED_DC_PIN);		// set to CMD
+	}
+
+	oledMarkClean();
 
 	// return it back
 	oledInvertDebugLink();
@@ -228,12 +452,24 @@ const uint8_t *oledGetBuffer()
 void oledSetDebugLink(bool set)
 {
 	is_debug_link = set;
+	oledMarkDirtyAll();
 	oledRefresh();
 }
 
 void oledSetBuffer(uint8_t *buf)
 {
-	memcpy(_oledbuffer, buf, sizeof(_oledbuffer));
+	memcpy(_oledbuffer, buf, OLED_BUFSIZE);
+	oledMarkDirtyAll();
+	_oledgeneration++;
+}
+
+/*
+ * Counts how often the buffer was cleared or replaced, so a layout that
+ * updates its screen in place can tell whether that screen is still there.
+ */
+uint32_t oledGeneration(void)
+{
+	return _oledgeneration;
 }
 
 void oledDrawChar(int x, int y, char c, int zoom)
@@ -249,14 +485,18 @@ void oledDrawChar(int x, int y, char c, int zoom)
 		return;
 	}
 
+	// font columns already have the buffer's bit order (top row in the MSB)
+	if (zoom <= 1) {
+		for (int xo = 0; xo < char_width; xo++) {
+			oledBlitColumn(x + xo, y, char_data[xo], char_data[xo]);
+		}
+		return;
+	}
+
 	for (int xo = 0; xo < char_width; xo++) {
 		for (int yo = 0; yo < FONT_HEIGHT; yo++) {
 			if (char_data[xo] & (1 << (FONT_HEIGHT - 1 - yo))) {
-				if (zoom <= 1) {
-					oledDrawPixel(x + xo, y + yo);
-				} else {
-					oledBox(x + xo * zoom, y + yo * zoom, x + (xo + 1) * zoom - 1, y + (yo + 1) * zoom - 1, true);
-				}
+				oledBox(x + xo * zoom, y + yo * zoom, x + (xo + 1) * zoom - 1, y + (yo + 1) * zoom - 1, true);
 			}
 		}
 	}
@@ -309,58 +549,125 @@ void oledDrawStringRight(int x, int y, const char* text)
 	oledDrawString(x, y, text);
 }
 
+/*
+ * Packed bitmaps hold one byte per column of 8 rows, band by band, so
+ * they are decoded straight into page bytes: 0x80 | (n - 1) repeats the
+ * next byte n times, n - 1 < 0x80 is followed by n literal bytes.
+ */
+static void oledDrawPacked(int x, int y, const BITMAP *bmp)
+{
+	const uint8_t *p = bmp->data;
+	int total = bmp->width * ((bmp->height + 7) / 8);
+	int pos = 0;
+	while (pos < total) {
+		uint8_t c = *p++;
+		int n = (c & 0x7F) + 1;
+		bool run = c & 0x80;
+		for (int k = 0; k < n && pos < total; k++, pos++) {
+			int band = pos / bmp->width;
+			int rows = MIN(bmp->height - band * 8, 8);
+			oledBlitColumn(x + pos % bmp->width, y + band * 8, run ? *p : p[k], 0xFF << (8 - rows));
+		}
+		p += run ? 1 : n;
+	}
+}
+
 void oledDrawBitmap(int x, int y, const BITMAP *bmp)
 {
-	for (int i = 0; i < bmp->width; i++) {
-		for (int j = 0; j < bmp->height; j++) {
-			if (bmp->data[(i / 8) + j * bmp->width / 8] & (1 << (7 - i % 8))) {
-				oledDrawPixel(x + i, y + j);
-			} else {
-				oledClearPixel(x + i, y + j);
+	if (bmp->packed) {
+		oledDrawPacked(x, y, bmp);
+		return;
+	}
+	// bitmaps are stored in rows (MSB leftmost), transpose them 8x8 at a time
+	int stride = bmp->width / 8;
+	for (int j = 0; j < bmp->height; j += 8) {
+		int rows = MIN(bmp->height - j, 8);
+		uint8_t mask = 0xFF << (8 - rows);
+		for (int bx = 0; bx < stride; bx++) {
+			uint8_t block[8] = {0}, cols[8];
+			for (int k = 0; k < rows; k++) {
+				block[k] = bmp->data[bx + (j + k) * stride];
+			}
+			oledTranspose8(block, cols);
+			for (int i = 0; i < 8; i++) {
+				oledBlitColumn(x + bx * 8 + i, y + j, cols[i], mask);
 			}
 		}
 	}
 }
 
 /*
- * Inverts box between (x1,y1) and (x2,y2) inclusive.
+ * Doubles the bits of a nibble (top pixel in bit 3) into a byte (top
+ * pixel in the MSB), for drawing at zoom 2.
  */
-void oledInvert(int x1, int y1, int x2, int y2)
+static const uint8_t oledZoom2[16] = {
+	0x00, 0x03, 0x0C, 0x0F, 0x30, 0x33, 0x3C, 0x3F,
+	0xC0, 0xC3, 0xCC, 0xCF, 0xF0, 0xF3, 0xFC, 0xFF,
+};
+
+/*
+ * Draws a width x height image stored as one run of bits, row after row
+ * with no padding and MSB first (the qr_encode output format). Every bit
+ * becomes a zoom x zoom square (zoom 1 or 2), lit for set bits or dark
+ * with invert. The image may be at most OLED_WIDTH bits wide.
+ */
+void oledDrawBits(int x, int y, const uint8_t *bits, int width, int height, int zoom, bool invert)
 {
-	x1 = MAX(x1, 0);
-	y1 = MAX(y1, 0);
-	x2 = MIN(x2, OLED_WIDTH - 1);
-	y2 = MIN(y2, OLED_HEIGHT - 1);
-	for (int x = x1; x <= x2; x++) {
-		for (int y = y1; y <= y2; y++) {
-			oledInvertPixel(x,y);
+	if ((zoom != 1 && zoom != 2) || width > OLED_WIDTH) {
+		return;
+	}
+	int per = 8 / zoom;	// image rows per page byte
+	for (int j = 0; j < height; j += per) {
+		int rows = MIN(height - j, per);
+		// gather the next rows column-wise, top row in the highest bit
+		uint8_t cols[OLED_WIDTH] = {0};
+		for (int k = 0; k < rows; k++) {
+			int a = (j + k) * width;
+			const uint8_t *p = bits + a / 8;
+			int shift = 7 - a % 8;
+			int b = per - 1 - k;
+			for (int i = 0; i < width; i++) {
+				cols[i] |= ((*p >> shift) & 1) << b;
+				if (--shift < 0) {
+					shift = 7;
+					p++;
+				}
+			}
+		}
+		uint8_t mask = zoom == 2 ? oledZoom2[(0x0F << (4 - rows)) & 0x0F] : 0xFF << (8 - rows);
+		for (int i = 0; i < width; i++) {
+			uint8_t col = zoom == 2 ? oledZoom2[cols[i]] : cols[i];
+			if (invert) {
+				col = ~col;
+			}
+			for (int z = 0; z < zoom; z++) {
+				oledBlitColumn(x + i * zoom + z, y + j * zoom, col, mask);
+			}
 		}
 	}
 }
 
+/*
+ * Inverts box between (x1,y1) and (x2,y2) inclusive.
+ */
+void oledInvert(int x1, int y1, int x2, int y2)
+{
+	oledBoxOp(x1, y1, x2, y2, OLED_OP_INVERT);
+}
+
 /*
  * Draw a filled rectangle.
  */
 void oledBox(int x1, int y1, int x2, int y2, bool set)
 {
-	x1 = MAX(x1, 0);
-	y1 = MAX(y1, 0);
-	x2 = MIN(x2, OLED_WIDTH - 1);
-	y2 = MIN(y2, OLED_HEIGHT - 1);
-	for (int x = x1; x <= x2; x++) {
-		for (int y = y1; y <= y2; y++) {
-			set ? oledDrawPixel(x, y) : oledClearPixel(x, y);
-		}
-	}
+	oledBoxOp(x1, y1, x2, y2, set ? OLED_OP_SET : OLED_OP_CLEAR);
 }
 
 void oledHLine(int y) {
 	if (y < 0 || y >= OLED_HEIGHT) {
 		return;
 	}
-	for (int x = 0; x < OLED_WIDTH; x++) {
-		oledDrawPixel(x, y);
-	}
+	oledBoxOp(0, y, OLED_WIDTH - 1, y, OLED_OP_SET);
 }
 
 /*
@@ -368,14 +675,32 @@ void oledHLine(int y) {
  */
 void oledFrame(int x1, int y1, int x2, int y2)
 {
-	for (int x = x1; x <= x2; x++) {
-		oledDrawPixel(x, y1);
-		oledDrawPixel(x, y2);
-	}
-	for (int y = y1 + 1; y < y2; y++) {
-		oledDrawPixel(x1, y);
-		oledDrawPixel(x2, y);
+	oledBoxOp(x1, y1, x2, y1, OLED_OP_SET);
+	oledBoxOp(x1, y2, x2, y2, OLED_OP_SET);
+	oledBoxOp(x1, y1 + 1, x1, y2 - 1, OLED_OP_SET);
+	oledBoxOp(x2, y1 + 1, x2, y2 - 1, OLED_OP_SET);
+}
+
+/*
+ * Start swiping the current contents out. This clears the buffer; the
+ * animation is advanced by oledAnimate() and oledRefresh().
+ */
+static void oledSwipe(bool left, uint32_t duration)
+{
+#if EMULATOR
+#if HEADLESS
+	duration = 0;
+#endif
+#endif
+	if (duration > 0) {
+		memcpy(_oledbuffers[1], _oledbuffer, OLED_BUFSIZE);
+		_oledswipe.active = true;
+		_oledswipe.left = left;
+		_oledswipe.start = timer_ms();
+		_oledswipe.duration = duration;
+		_oledswipe.shown = 0;
 	}
+	oledClear();
 }
 
 /*
@@ -384,15 +709,7 @@ void oledFrame(int x1, int y1, int x2, int y2)
  */
 void oledSwipeLeft(void)
 {
-	for (int i = 0; i < OLED_WIDTH; i++) {
-		for (int j = 0; j < OLED_HEIGHT / 8; j++) {
-			for (int k = OLED_WIDTH-1; k > 0; k--) {
-				_oledbuffer[j * OLED_WIDTH + k] = _oledbuffer[j * OLED_WIDTH + k - 1];
-			}
-			_oledbuffer[j * OLED_WIDTH] = 0;
-		}
-		oledRefresh();
-	}
+	oledSwipe(true, OLED_SWIPE_LEFT_MS);
 }
 
 /*
@@ -401,19 +718,50 @@ void oledSwipeLeft(void)
  */
 void oledSwipeRight(void)
 {
-	for (int i = 0; i < OLED_WIDTH / 4; i++) {
-		for (int j = 0; j < OLED_HEIGHT / 8; j++) {
-			for (int k = 0; k < OLED_WIDTH / 4 - 1; k++) {
-				_oledbuffer[k * 4 + 0 + j * OLED_WIDTH] = _oledbuffer[k * 4 + 4 + j * OLED_WIDTH];
-				_oledbuffer[k * 4 + 1 + j * OLED_WIDTH] = _oledbuffer[k * 4 + 5 + j * OLED_WIDTH];
-				_oledbuffer[k * 4 + 2 + j * OLED_WIDTH] = _oledbuffer[k * 4 + 6 + j * OLED_WIDTH];
-				_oledbuffer[k * 4 + 3 + j * OLED_WIDTH] = _oledbuffer[k * 4 + 7 + j * OLED_WIDTH];
-			}
-			_oledbuffer[j * OLED_WIDTH + OLED_WIDTH - 1] = 0;
-			_oledbuffer[j * OLED_WIDTH + OLED_WIDTH - 2] = 0;
-			_oledbuffer[j * OLED_WIDTH + OLED_WIDTH - 3] = 0;
-			_oledbuffer[j * OLED_WIDTH + OLED_WIDTH - 4] = 0;
+	oledSwipe(false, OLED_SWIPE_RIGHT_MS);
+}
+
+/*
+ * Show the frame of a running swipe that is due by now. Called from the
+ * main loop (usbPoll) so the animation runs while USB is serviced.
+ */
+void oledAnimate(void)
+{
+	if (!_oledswipe.active) {
+		return;
+	}
+
+	uint32_t elapsed = timer_ms() - _oledswipe.start;
+	if (elapsed >= _oledswipe.duration) {
+		// show the screen drawn in the meantime
+		_oledswipe.active = false;
+		oledFlush();
+		return;
+	}
+
+	int shift = elapsed * OLED_WIDTH / _oledswipe.duration;
+	int step = shift - _oledswipe.shown;
+	if (step <= 0) {
+		return;
+	}
+	_oledswipe.shown = shift;
+
+	// buffer columns are mirrored: moving content left means higher offsets
+	uint8_t *frame = _oledbuffers[1];
+	for (int j = 0; j < OLED_HEIGHT / 8; j++) {
+		uint8_t *row = frame + j * OLED_WIDTH;
+		if (_oledswipe.left) {
+			memmove(row + step, row, OLED_WIDTH - step);
+			memset(row, 0, step);
+		} else {
+			memmove(row, row + step, OLED_WIDTH - step);
+			memset(row + OLED_WIDTH - step, 0, step);
 		}
-		oledRefresh();
 	}
+
+	_oledbuffer = frame;
+	oledMarkDirtyAll();
+	oledFlush();
+	_oledbuffer = _oledbuffers[0];
+	oledMarkDirtyAll();
 }
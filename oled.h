@@ -30,19 +30,31 @@
 #define OLED_HEIGHT  64
 #define OLED_BUFSIZE (OLED_WIDTH * OLED_HEIGHT / 8)
 
+// Part of the buffer changed since the last refresh: buffer pages
+// (OLED_WIDTH bytes each) and columns, both inclusive
+typedef struct {
+	int page_start, page_end;
+	int col_start, col_end;
+} OledWindow;
+
 void oledInit(void);
 void oledClear(void);
 void oledRefresh(void);
+void oledFlush(void);
+bool oledDirtyWindow(int *page, OledWindow *window);
+void oledMarkClean(void);
 
 void oledSetDebugLink(bool set);
 void oledInvertDebugLink(void);
 
 void oledSetBuffer(uint8_t *buf);
 const uint8_t *oledGetBuffer(void);
+uint32_t oledGeneration(void);
 void oledDrawPixel(int x, int y);
 void oledClearPixel(int x, int y);
 void oledInvertPixel(int x, int y);
 void oledDrawChar(int x, int y, char c, int zoom);
+char oledConvertChar(const char c);
 int oledStringWidth(const char *text);
 
 #define oledDrawString(x, y, text) oledDrawStringSize((x),  (y), (text), 1)
@@ -51,11 +63,13 @@ void oledDrawStringSize(int x, int y, const char* text, int size);
 void oledDrawStringCenter(int y, const char* text);
 void oledDrawStringRight(int x, int y, const char* text);
 void oledDrawBitmap(int x, int y, const BITMAP *bmp);
+void oledDrawBits(int x, int y, const uint8_t *bits, int width, int height, int zoom, bool invert);
 void oledInvert(int x1, int y1, int x2, int y2);
 void oledBox(int x1, int y1, int x2, int y2, bool set);
 void oledHLine(int y);
 void oledFrame(int x1, int y1, int x2, int y2);
 void oledSwipeLeft(void);
 void oledSwipeRight(void);
+void oledAnimate(void);
 
 #endif
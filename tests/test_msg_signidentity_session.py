@@ -0,0 +1,63 @@
+# Identities confirmed once per session (firmware built with
+# IDENTITY_CONFIRM_ONCE=1) must be confirmed again after the device is
+# locked or reloaded.
+#
+# Run with the emulator through script/test:
+#   IDENTITY_CONFIRM_ONCE=1 EMULATOR=1 script/test
+
+import os
+
+import pytest
+
+from trezorlib import messages as proto
+from trezorlib.tests.device_tests.common import TrezorTest
+
+IDENTITY = proto.IdentityType(proto='https', user=None, host='satoshi@bitcoin.org', port=None, path='/login', index=0)
+
+
+@pytest.mark.skipif(os.environ.get('IDENTITY_CONFIRM_ONCE') != '1', reason='firmware built without IDENTITY_CONFIRM_ONCE=1')
+class TestMsgSignidentitySession(TrezorTest):
+
+    def sign(self):
+        return self.client.sign_identity(IDENTITY, b'challenge', 'visual')
+
+    def unlock(self):
+        with self.client:
+            self.client.set_expected_responses([proto.PinMatrixRequest(), proto.PublicKey()])
+            self.client.get_public_node([0])
+
+    def test_confirm_once(self):
+        self.setup_mnemonic_pin_nopassphrase()
+        with self.client:
+            self.client.set_expected_responses([proto.ButtonRequest(), proto.PinMatrixRequest(), proto.SignedIdentity()])
+            self.sign()
+        with self.client:
+            self.client.set_expected_responses([proto.SignedIdentity()])
+            self.sign()
+
+    def test_lock(self):
+        self.setup_mnemonic_pin_nopassphrase()
+        with self.client:
+            self.client.set_expected_responses([proto.ButtonRequest(), proto.PinMatrixRequest(), proto.SignedIdentity()])
+            self.sign()
+
+        # ClearSession locks the device through session_clear(true), as autolock does
+        self.client.clear_session()
+        self.unlock()
+        with self.client:
+            self.client.set_expected_responses([proto.ButtonRequest(), proto.SignedIdentity()])
+            self.sign()
+
+    def test_reload(self):
+        self.setup_mnemonic_pin_nopassphrase()
+        with self.client:
+            self.client.set_expected_responses([proto.ButtonRequest(), proto.PinMatrixRequest(), proto.SignedIdentity()])
+            self.sign()
+
+        # loading the same seed again must not carry the confirmation over
+        self.client.wipe_device()
+        self.setup_mnemonic_pin_nopassphrase()
+        self.unlock()
+        with self.client:
+            self.client.set_expected_responses([proto.ButtonRequest(), proto.SignedIdentity()])
+            self.sign()